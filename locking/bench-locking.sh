@@ -0,0 +1,22 @@
+#!/bin/bash
+# Times each way of claiming jobs over 1 to 64 threads, with the
+# jobs printing nothing, so that only the claiming is measured.
+# With a skew above 1, the top 1/64 of the jobs cost that many
+# times more. Each mode's log is first checked for duplicate and
+# missing jobs with check-locking.sh.
+#
+# usage: bench-locking.sh [jobs] [batch] [skew]
+
+jobs=${1:-10000000}
+batch=${2:-64}
+skew=${3:-1}
+
+cd "$(dirname "$0")"
+./check-locking.sh > /dev/null || exit 1
+
+echo "$(nproc) cpus, $jobs jobs, batches of $batch, skew $skew"
+for threads in 1 2 4 8 16 32 64; do
+  for mode in mutex spinlock atomic batched pool; do
+    ./locking-jobs -q -m $mode -t $threads -k $batch -n $jobs -s $skew || exit 1
+  done
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Runs every safe mode, with and without the writer thread, and
+# checks the log for duplicate and missing jobs. Each thread's
+# lines come out in blocks, so the log is sorted before uniq -d.
+#
+# usage: check-locking.sh [jobs] [threads]
+
+jobs=${1:-100000}
+threads=${2:-4}
+
+cd "$(dirname "$0")"
+gcc -pthread -O2 -g -o locking-jobs locking-jobs.c pool.c || exit 1
+
+failed=0
+for mode in mutex spinlock atomic batched pool; do
+  for writer in "" -w; do
+    log=$(./locking-jobs -m $mode -t $threads -n $jobs $writer) || exit 1
+    duplicates=$(echo "$log" | sort | uniq -d | wc -l)
+    lines=$(echo "$log" | sort -u | wc -l)
+    if [ $duplicates != 0 ] || [ $lines != $jobs ]; then
+      echo "$mode $writer: $lines distinct jobs of $jobs, $duplicates duplicated"
+      failed=1
+    fi
+  done
+done
+
+[ $failed = 0 ] && echo "no duplicate or missing jobs"
+exit $failed
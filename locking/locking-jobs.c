@@ -1,64 +1,508 @@
 #include <unistd.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
 #include <pthread.h>
 
-// gcc -pthread -g -o locking-jobs locking-jobs.c
+#include "pool.h"
+
+// gcc -pthread -O2 -g -o locking-jobs locking-jobs.c pool.c
+
+// Usage: locking-jobs [-m mode] [-t threads] [-k batch] [-n jobs]
+//                     [-s skew] [-w] [-q]
+//
+// Threads, one per online CPU unless -t says otherwise, take jobs
+// off a shared counter until it runs out. The mode says how a
+// thread claims one:
+//
+//   unsafe    reads the counter and then decrements it, so two
+//             threads can take the same job, or lose one
+//   mutex     the same, under a pthread mutex
+//   spinlock  the same, under a pthread spinlock
+//   atomic    one atomic fetch-and-subtract per job (the default)
+//   batched   one atomic fetch-and-subtract per batch of k jobs,
+//             so the counter's cache line moves k times less
+//   pool      no shared counter: the work-stealing pool in pool.c
+//             splits the jobs into ranges of at most k
+//
+// With -s, the jobs in the top 1/64 of the ids cost skew times as
+// much as the others, so whoever is handed that slice up front has
+// far more work than the rest.
+//
+// Each thread formats its log lines into a buffer of its own and
+// writes them out with write(2) once it holds FLUSH_BYTES, always
+// in whole lines, so threads wait on each other at most once per
+// buffer rather than once per line.
+// With -w the full buffers go through a lock-free ring to a single
+// writer thread instead, and the workers carry on with a second
+// buffer meanwhile.
+//
+// With -q the jobs print nothing, and the program instead checks
+// that every job was done exactly once and reports the time per
+// job. bench-locking.sh runs all the modes over 1 to 64 threads.
 
 // Tips
 //
 // You can direct output from this program to a file like this:
 //
-// $ ./locking-jobs > output.txt
+// $ ./locking-jobs -m unsafe > output.txt
 //
-// Then you can look for duplicate lines in the file like this:
+// Then you can look for duplicate lines in the file like this,
+// sorting first since each thread's lines come out in blocks:
 //
-// $ cat output.txt | uniq -d
+// $ sort output.txt | uniq -d
 //
 // Alternatively you can skip the file and just pipe to uniq:
 //
-// $ ./locking-jobs | uniq -d
+// $ ./locking-jobs -m unsafe | sort | uniq -d
+//
+// Any of the other modes should print no duplicates, with or
+// without -w. check-locking.sh checks them all this way.
+
+enum mode {
+  MODE_UNSAFE,
+  MODE_MUTEX,
+  MODE_SPINLOCK,
+  MODE_ATOMIC,
+  MODE_BATCHED,
+  MODE_POOL,
+};
+
+static const char *mode_names[] = {"unsafe", "mutex", "spinlock", "atomic", "batched", "pool"};
+
+// A thread's log lines are flushed once they pass this many bytes.
+#define FLUSH_BYTES (64 * 1024)
+
+// Full buffers the ring to the writer thread can hold; a power of 2.
+#define RING_SIZE 64
+
+struct buffer {
+  char data[FLUSH_BYTES + 64];
+  size_t length;
+  int busy;        // queued for the writer thread
+};
+
+// What each thread did, on cache lines of its own, and the buffers
+// its log goes to: the second one only with -w.
+struct done {
+  uint64_t count;
+  uint64_t sum;
+  struct buffer *buffers;
+  int current;
+} __attribute__((aligned(64)));
 
-#define THREAD_COUNT 2
+// A bounded multi-producer, single-consumer ring of full buffers,
+// after Vyukov: each cell's sequence number says whether it is
+// free for the producer at tail or filled for the consumer at head.
+struct cell {
+  uint64_t sequence;
+  struct buffer *buffer;
+};
+
+struct ring {
+  uint64_t tail;
+  char padding[56];
+  uint64_t head;
+  struct cell cells[RING_SIZE];
+};
+
+// Two decimal digits at a time, for formatting without printf.
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+enum mode mode = MODE_ATOMIC;
+int64_t batch = 64;
+int skew = 1;
+int64_t heavy_jobs = 0;  // ids above this cost skew times more
+bool quiet = false;
+bool use_writer = false;
+
+struct ring ring;
+bool producers_done = false;
+
+// Writes of more than PIPE_BUF bytes to a pipe can interleave, so
+// without -w the threads take turns, once per buffer.
+pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int64_t jobs_available = 1000000;
+pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_spinlock_t jobs_spinlock;
+
+static void write_all(const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(STDOUT_FILENO, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("write");
+      exit(1);
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+static void ring_push(struct buffer *buffer) {
+  uint64_t tail = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+  struct cell *cell;
+
+  for (;;) {
+    cell = &ring.cells[tail % RING_SIZE];
+    uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == tail) {
+      if (__atomic_compare_exchange_n(&ring.tail, &tail, tail + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (sequence < tail) {
+      // Full: wait for the writer to catch up.
+      sched_yield();
+      tail = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+    } else {
+      tail = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->buffer = buffer;
+  __atomic_store_n(&cell->sequence, tail + 1, __ATOMIC_RELEASE);
+}
+
+static struct buffer *ring_pop(void) {
+  struct cell *cell = &ring.cells[ring.head % RING_SIZE];
+  if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != ring.head + 1) {
+    return NULL;
+  }
+
+  struct buffer *buffer = cell->buffer;
+  __atomic_store_n(&cell->sequence, ring.head + RING_SIZE, __ATOMIC_RELEASE);
+  ring.head++;
+  return buffer;
+}
+
+// Writes the full buffers from the ring until the workers are
+// done and it is empty.
+void *run_writer(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    // Once the workers are done, whatever they pushed is visible.
+    bool finished = __atomic_load_n(&producers_done, __ATOMIC_ACQUIRE);
+    struct buffer *buffer = ring_pop();
+    if (buffer) {
+      write_all(buffer->data, buffer->length);
+      buffer->length = 0;
+      __atomic_store_n(&buffer->busy, 0, __ATOMIC_RELEASE);
+    } else if (finished) {
+      break;
+    } else {
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+// Writes out a thread's buffer, or hands it to the writer thread
+// and switches to the other one, waiting if that is still queued.
+static void flush_output(struct done *done) {
+  struct buffer *buffer = &done->buffers[done->current];
+  if (buffer->length == 0) {
+    return;
+  }
 
-void do_job(uint64_t job_id) {
-  for (int i = 0; i < 5; i++) {
+  if (!use_writer) {
+    pthread_mutex_lock(&output_mutex);
+    write_all(buffer->data, buffer->length);
+    pthread_mutex_unlock(&output_mutex);
+    buffer->length = 0;
+    return;
+  }
+
+  buffer->busy = 1;
+  ring_push(buffer);
+  done->current ^= 1;
+  while (__atomic_load_n(&done->buffers[done->current].busy, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+}
+
+// Appends "Completed job #<id>" and a newline to the buffer.
+static void log_job(struct done *done, uint64_t job_id) {
+  static const char prefix[] = "Completed job #";
+  struct buffer *buffer = &done->buffers[done->current];
+  char *p = buffer->data + buffer->length;
+
+  memcpy(p, prefix, sizeof(prefix) - 1);
+  p += sizeof(prefix) - 1;
+
+  char digits[20];
+  char *d = digits + sizeof(digits);
+  while (job_id >= 100) {
+    d -= 2;
+    memcpy(d, &digit_pairs[job_id % 100 * 2], 2);
+    job_id /= 100;
+  }
+  if (job_id >= 10) {
+    d -= 2;
+    memcpy(d, &digit_pairs[job_id * 2], 2);
+  } else {
+    *--d = '0' + job_id;
+  }
+  memcpy(p, d, digits + sizeof(digits) - d);
+  p += digits + sizeof(digits) - d;
+  *p++ = '\n';
+
+  buffer->length = p - buffer->data;
+  if (buffer->length >= FLUSH_BYTES) {
+    flush_output(done);
+  }
+}
+
+void do_job(uint64_t job_id, struct done *done) {
+  int cost = (int64_t)job_id > heavy_jobs ? 5 * skew : 5;
+  for (int i = 0; i < cost; i++) {
     asm("nop");
   }
-  printf("Completed job #%lld\n", job_id);
+  if (quiet) {
+    done->count++;
+    done->sum += job_id;
+  } else {
+    log_job(done, job_id);
+  }
 }
 
-void *do_jobs(void *thread_id)
-{
+// Claims up to batch jobs, the highest first, as the range
+// (*last, first]. Returns false once there are none left.
+bool claim_jobs(int64_t *first, int64_t *last) {
   int64_t current_job = 0;
-  while (true) {
+
+  switch (mode) {
+  case MODE_UNSAFE:
     current_job = jobs_available;
     if (current_job < 1) {
-      break;
+      return false;
     }
     jobs_available--;
+    break;
+  case MODE_MUTEX:
+    pthread_mutex_lock(&jobs_mutex);
+    current_job = jobs_available;
+    if (current_job > 0) {
+      jobs_available--;
+    }
+    pthread_mutex_unlock(&jobs_mutex);
+    break;
+  case MODE_SPINLOCK:
+    pthread_spin_lock(&jobs_spinlock);
+    current_job = jobs_available;
+    if (current_job > 0) {
+      jobs_available--;
+    }
+    pthread_spin_unlock(&jobs_spinlock);
+    break;
+  case MODE_ATOMIC:
+    // The counter may go below zero as threads run out, but each
+    // value above it is handed out once.
+    current_job = __atomic_fetch_sub(&jobs_available, 1, __ATOMIC_RELAXED);
+    break;
+  case MODE_POOL:
+    // The pool hands out ranges itself.
+    return false;
+  case MODE_BATCHED:
+    current_job = __atomic_fetch_sub(&jobs_available, batch, __ATOMIC_RELAXED);
+    if (current_job < 1) {
+      return false;
+    }
+    *first = current_job;
+    *last = current_job > batch ? current_job - batch : 0;
+    return true;
+  }
+
+  if (current_job < 1) {
+    return false;
+  }
+  *first = current_job;
+  *last = current_job - 1;
+  return true;
+}
+
+void *do_jobs(void *arg)
+{
+  struct done *done = arg;
+  int64_t first, last;
 
-    do_job(current_job);
+  while (claim_jobs(&first, &last)) {
+    for (int64_t job = first; job > last; job--) {
+      do_job(job, done);
+    }
+  }
+  if (!quiet) {
+    flush_output(done);
   }
 
   pthread_exit(NULL);
 }
 
+// The pool's jobs are [1, job count], each range run in turn.
+void do_job_range(int64_t first, int64_t last, int worker, void *arg) {
+  struct done *done = arg;
+  for (int64_t job = first; job < last; job++) {
+    do_job(job, &done[worker]);
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-m unsafe|mutex|spinlock|atomic|batched|pool] "
+          "[-t threads] [-k batch] [-n jobs] [-s skew] [-w] [-q]\n", name);
+}
+
 int main(int argc, char **argv) {
-  pthread_t threads[THREAD_COUNT];
-  for (int i = 0; i < THREAD_COUNT; i++) {
-    if (pthread_create(&threads[i], NULL, do_jobs, (void*)(long)i) != 0) {
+  int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:k:n:s:wq")) != -1) {
+    switch (opt) {
+    case 'm':
+      mode = MODE_UNSAFE;
+      while (mode <= MODE_POOL && strcmp(optarg, mode_names[mode]) != 0) {
+        mode++;
+      }
+      if (mode > MODE_POOL) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 't':
+      thread_count = atoi(optarg);
+      break;
+    case 'k':
+      batch = atoll(optarg);
+      break;
+    case 'n':
+      jobs_available = atoll(optarg);
+      break;
+    case 's':
+      skew = atoi(optarg);
+      break;
+    case 'w':
+      use_writer = true;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (thread_count < 1 || batch < 1 || jobs_available < 0 || skew < 1 ||
+      optind != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int64_t job_count = jobs_available;
+  heavy_jobs = job_count - job_count / 64;
+  pthread_spin_init(&jobs_spinlock, PTHREAD_PROCESS_PRIVATE);
+
+  pthread_t *threads = malloc(sizeof(*threads) * thread_count);
+  struct done *done = aligned_alloc(64, sizeof(*done) * thread_count);
+  if (!threads || !done) {
+    printf("Memory allocation error!\n");
+    return 1;
+  }
+  memset(done, 0, sizeof(*done) * thread_count);
+  for (int i = 0; !quiet && i < thread_count; i++) {
+    done[i].buffers = calloc(use_writer ? 2 : 1, sizeof(struct buffer));
+    if (!done[i].buffers) {
+      printf("Memory allocation error!\n");
+      return 1;
+    }
+  }
+
+  pthread_t writer;
+  if (!quiet && use_writer) {
+    for (int i = 0; i < RING_SIZE; i++) {
+      ring.cells[i].sequence = i;
+    }
+    if (pthread_create(&writer, NULL, run_writer, NULL) != 0) {
       printf("Thread creation error!\n");
+      return 1;
     }
   }
 
-  for (int i = 0; i < THREAD_COUNT; i++) {
+  double start = now();
+  int started = 0;
+  if (mode == MODE_POOL) {
+    // Starting and stopping the pool's threads is timed as well, as
+    // the other modes' are.
+    struct pool *pool = pool_create(thread_count);
+    if (!pool) {
+      printf("Thread creation error!\n");
+      return 1;
+    }
+    pool_run(pool, 1, jobs_available + 1, batch, do_job_range, done);
+    for (int i = 0; !quiet && i < thread_count; i++) {
+      flush_output(&done[i]);
+    }
+    pool_destroy(pool);
+  }
+  for (int i = 0; mode != MODE_POOL && i < thread_count; i++) {
+    if (pthread_create(&threads[started], NULL, do_jobs, &done[started]) != 0) {
+      printf("Thread creation error!\n");
+      continue;
+    }
+    started++;
+  }
+
+  for (int i = 0; i < started; i++) {
     pthread_join(threads[i], NULL);
   }
+  if (!quiet && use_writer) {
+    __atomic_store_n(&producers_done, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+  }
+  double seconds = now() - start;
+
+  if (!quiet) {
+    return 0;
+  }
+
+  // Every job from 1 to job_count once, and no other, gives this
+  // count and sum.
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  for (int i = 0; i < thread_count; i++) {
+    count += done[i].count;
+    sum += done[i].sum;
+  }
+  bool exact = count == (uint64_t)job_count &&
+               sum == (uint64_t)job_count * (job_count + 1) / 2;
 
-  return 0;
+  printf("%-8s %3d threads %10lld jobs %8.2f ns/job %s\n", mode_names[mode],
+         thread_count, (long long)count, seconds * 1e9 / (count ? count : 1),
+         exact ? "ok" : "WRONG");
+  return exact ? 0 : 1;
 }
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+// Splitting halves a range each time, so a deque never holds more
+// than one range per bit of int64_t, plus the one it was seeded
+// with. The deques therefore never need to grow.
+#define DEQUE_SIZE 128
+
+// Failed rounds of stealing before a worker yields the CPU.
+#define STEAL_ROUNDS 4
+
+struct range {
+  int64_t first;
+  int64_t last;
+};
+
+// The Chase-Lev deque, after Le, Pop, Cohen and Zappa Nardelli's
+// C11 version: the owner pushes and takes at bottom, thieves steal
+// at top. Slots are read field by field; a thief that reads a slot
+// as the owner reuses it also loses the race for top, and throws
+// the range away. Padded so that workers' deques do not share
+// cache lines.
+struct deque {
+  int64_t top;
+  char padding1[56];
+  int64_t bottom;
+  char padding2[56];
+  struct range slots[DEQUE_SIZE];
+};
+
+struct worker {
+  struct pool *pool;
+  struct deque deque;
+  pthread_t thread;
+  uint64_t random;
+  int index;
+};
+
+struct pool {
+  struct worker *workers;
+  int threads;
+
+  // The run in progress.
+  int64_t grain;
+  void (*run)(int64_t first, int64_t last, int worker, void *arg);
+  void *arg;
+  int64_t pending;  // jobs not yet done
+
+  // Workers wait for the generation to change to start on a run,
+  // and pool_run waits for all of them to have finished it.
+  pthread_mutex_t lock;
+  pthread_cond_t started;
+  pthread_cond_t finished;
+  uint64_t generation;
+  int finished_count;
+  bool shutdown;
+};
+
+static void
+push(struct deque *deque, struct range range)
+{
+  int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  struct range *slot = &deque->slots[b % DEQUE_SIZE];
+  __atomic_store_n(&slot->first, range.first, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->last, range.last, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+static bool
+take(struct deque *deque, struct range *range)
+{
+  int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+  if (t > b) {
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  struct range *slot = &deque->slots[b % DEQUE_SIZE];
+  range->first = __atomic_load_n(&slot->first, __ATOMIC_RELAXED);
+  range->last = __atomic_load_n(&slot->last, __ATOMIC_RELAXED);
+  if (t < b) {
+    return true;
+  }
+
+  // The last range: a thief may be after it too.
+  bool won = __atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  return won;
+}
+
+static bool
+steal(struct deque *deque, struct range *range)
+{
+  int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b) {
+    return false;
+  }
+
+  struct range *slot = &deque->slots[t % DEQUE_SIZE];
+  range->first = __atomic_load_n(&slot->first, __ATOMIC_RELAXED);
+  range->last = __atomic_load_n(&slot->last, __ATOMIC_RELAXED);
+  return __atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// xorshift64, for picking victims.
+static uint64_t
+next_random(uint64_t *state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+// Works on a range, splitting off the upper half for others while
+// it is bigger than the grain.
+static void
+run_range(struct worker *worker, struct range range)
+{
+  struct pool *pool = worker->pool;
+
+  while (range.last - range.first > pool->grain) {
+    int64_t middle = range.first + (range.last - range.first) / 2;
+    push(&worker->deque, (struct range){middle, range.last});
+    range.last = middle;
+  }
+
+  pool->run(range.first, range.last, worker->index, pool->arg);
+  __atomic_fetch_sub(&pool->pending, range.last - range.first, __ATOMIC_RELEASE);
+}
+
+static void
+work(struct worker *worker)
+{
+  struct pool *pool = worker->pool;
+  struct range range;
+  int failed = 0;
+
+  while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0) {
+    if (take(&worker->deque, &range)) {
+      run_range(worker, range);
+      continue;
+    }
+
+    struct worker *victim = &pool->workers[next_random(&worker->random) % pool->threads];
+    if (victim != worker && steal(&victim->deque, &range)) {
+      run_range(worker, range);
+      failed = 0;
+    } else if (++failed >= STEAL_ROUNDS * pool->threads) {
+      sched_yield();
+      failed = 0;
+    }
+  }
+}
+
+static void *
+run_worker(void *arg)
+{
+  struct worker *worker = arg;
+  struct pool *pool = worker->pool;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen && !pool->shutdown) {
+      pthread_cond_wait(&pool->started, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    work(worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if (++pool->finished_count == pool->threads) {
+      pthread_cond_signal(&pool->finished);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+struct pool *
+pool_create(int threads)
+{
+  if (threads <= 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? online : 1;
+  }
+
+  struct pool *pool = calloc(1, sizeof(*pool));
+  if (!pool) {
+    return NULL;
+  }
+  pool->workers = calloc(threads, sizeof(*pool->workers));
+  if (!pool->workers) {
+    free(pool);
+    return NULL;
+  }
+
+  pool->threads = threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->started, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+
+  for (int i = 0; i < threads; i++) {
+    struct worker *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    worker->random = 0x9e3779b97f4a7c15 * (i + 1);
+    if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+      pool->threads = i;
+      pool_destroy(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+void
+pool_run(struct pool *pool, int64_t first, int64_t last, int64_t grain,
+         void (*run)(int64_t first, int64_t last, int worker, void *arg),
+         void *arg)
+{
+  if (last <= first) {
+    return;
+  }
+
+  // The workers are all parked, so seeding their deques from here
+  // cannot race with them. Each starts with an equal share.
+  pool->grain = grain > 0 ? grain : 1;
+  pool->run = run;
+  pool->arg = arg;
+  pool->pending = last - first;
+  for (int i = 0; i < pool->threads; i++) {
+    int64_t share_first = first + (last - first) / pool->threads * i;
+    int64_t share_last = i == pool->threads - 1 ? last :
+                         first + (last - first) / pool->threads * (i + 1);
+    if (share_last > share_first) {
+      push(&pool->workers[i].deque, (struct range){share_first, share_last});
+    }
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->finished_count = 0;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->started);
+  while (pool->finished_count < pool->threads) {
+    pthread_cond_wait(&pool->finished, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int
+pool_threads(const struct pool *pool)
+{
+  return pool->threads;
+}
+
+void
+pool_destroy(struct pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->started);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->threads; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  pthread_cond_destroy(&pool->finished);
+  pthread_cond_destroy(&pool->started);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
@@ -0,0 +1,29 @@
+#include <stdint.h>
+
+// A work-stealing thread pool for running a range of jobs.
+//
+// Each worker owns a Chase-Lev deque of job ranges. It takes the
+// newest range from the bottom of its own deque, and while that is
+// bigger than the grain it pushes back the upper half and goes on
+// with the lower half, so ranges are split only when someone works
+// on them. A worker whose deque is empty steals the oldest, and so
+// biggest, range from the top of a random victim's deque.
+
+struct pool;
+
+// Starts a pool of threads workers, or one per online CPU if
+// threads is 0. Returns NULL if it cannot.
+struct pool *pool_create(int threads);
+
+// Calls run(first, last, worker, arg) on ranges of at most grain
+// jobs that together cover [first, last) exactly once, and returns
+// when all are done. worker is the index of the worker running the
+// range, below pool_threads(). Only one pool_run may be in progress
+// at a time.
+void pool_run(struct pool *pool, int64_t first, int64_t last, int64_t grain,
+              void (*run)(int64_t first, int64_t last, int worker, void *arg),
+              void *arg);
+
+int pool_threads(const struct pool *pool);
+
+void pool_destroy(struct pool *pool);
@@ -0,0 +1,388 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "malloc.h"
+
+/*
+ * Collector benchmarks.
+ *
+ * usage: bench [threads] [allocations per thread]
+ *
+ *    Measures gcmalloc() throughput. Each thread allocates
+ *    small objects of mixed sizes and keeps the most recent
+ *    WINDOW of them alive, so collections have live data to
+ *    mark and garbage to sweep.
+ *
+ * usage: bench cycle [objects] [rounds]
+ *
+ *    Measures whole allocate/collect cycles on a large heap.
+ *    Each round builds a linked list of that many objects,
+ *    collects while it is live, drops it and collects again.
+ *
+ * usage: bench churn [slots] [allocations]
+ *
+ *    Measures fragmentation under churn. A table of slots
+ *    is kept full of objects of random sizes, and each step
+ *    replaces a random slot, so objects die in random order.
+ *    Fragmentation is sampled throughout the run, not only
+ *    right after collections.
+ *
+ * usage: bench fragment [rounds] [slots]
+ *
+ *    Runs long enough for fragmentation to build up. Each
+ *    round churns small objects through the slots and then
+ *    allocates one large object, and counts the rounds in
+ *    which the heap had to grow for it although more than
+ *    enough memory was free.
+ *
+ * usage: bench large [bytes] [allocations] [kept]
+ *
+ *    Measures the latency of large allocations. Objects of
+ *    the given size (default 256K) are allocated and filled
+ *    one after another, with the last few (default 8) kept
+ *    alive, and the mean, median and 99th percentile of
+ *    gcmalloc() are reported. Keeping all of them makes the
+ *    heap grow throughout.
+ *
+ * The slot tables are typed, so GC_COMPACT can move what
+ * they hold; run churn and fragment with and without it to
+ * compare.
+ */
+
+#define LARGE_OBJECT (256 * 1024)
+
+#define WINDOW 1024
+
+static long Allocations = 200000;
+
+struct Node {
+	struct Node *Next;
+	long Value;
+};
+
+static void *Allocate(void *Argument)
+{
+	void *Window[WINDOW] = { NULL };
+	
+	for (long i = 0; i < Allocations; ++i) {
+		size_t Size = 16 + (i % 8) * 16;
+		void *Buffer = gcmalloc(Size);
+		if (!Buffer) {
+			fprintf(stderr, "Out of memory\n");
+			abort();
+		}
+		
+		Window[i % WINDOW] = Buffer;
+	}
+	
+	return Window[0];
+}
+
+static double Now()
+{
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return Time.tv_sec + Time.tv_nsec / 1e9;
+}
+
+static int RunThroughput(int argc, char *argv[])
+{
+	int ThreadCount = argc > 1 ? atoi(argv[1]) : 1;
+	if (argc > 2) {
+		Allocations = atol(argv[2]);
+	}
+	
+	if (ThreadCount < 1 || Allocations < 1) {
+		fprintf(stderr, "usage: %s [threads] [allocations per thread]\n", argv[0]);
+		return 1;
+	}
+	
+	pthread_t Threads[ThreadCount];
+	double Start = Now();
+	
+	for (int i = 0; i < ThreadCount; ++i) {
+		pthread_create(&Threads[i], NULL, Allocate, NULL);
+	}
+	
+	for (int i = 0; i < ThreadCount; ++i) {
+		pthread_join(Threads[i], NULL);
+	}
+	
+	double Elapsed = Now() - Start;
+	long Total = Allocations * ThreadCount;
+	
+	printf("%d threads, %ld allocations in %.3f s: %.2f M/s, %.1f ns each\n",
+		ThreadCount, Total, Elapsed,
+		Total / Elapsed / 1e6,
+		Elapsed * 1e9 / Total);
+	
+	return 0;
+}
+
+static struct Node *BuildList(const GCLayout *Layout, long Count)
+{
+	struct Node *Head = NULL;
+	
+	for (long i = 0; i < Count; ++i) {
+		struct Node *Node = gcmalloc_typed(sizeof(struct Node), Layout);
+		if (!Node) {
+			fprintf(stderr, "Out of memory\n");
+			abort();
+		}
+		
+		Node->Next = Head;
+		Node->Value = i;
+		Head = Node;
+	}
+	
+	return Head;
+}
+
+static int RunCycles(int argc, char *argv[])
+{
+	long Objects = argc > 2 ? atol(argv[2]) : 1000000;
+	int Rounds = argc > 3 ? atoi(argv[3]) : 5;
+	
+	if (Objects < 1 || Rounds < 1) {
+		fprintf(stderr, "usage: %s cycle [objects] [rounds]\n", argv[0]);
+		return 1;
+	}
+	
+	size_t Offsets[] = { offsetof(struct Node, Next) };
+	GCLayout *Layout = gclayout(sizeof(struct Node), Offsets, 1);
+	
+	/* Only explicit collections, so every round does the same work */
+	setenv("GC_PERCENT", "off", 1);
+	
+	static struct Node *Live;
+	gcadd_root((void**)&Live);
+	gcscan_stack(false);
+	
+	double Building = 0, Marking = 0, Sweeping = 0;
+	
+	for (int Round = 0; Round < Rounds; ++Round) {
+		double Start = Now();
+		Live = BuildList(Layout, Objects);
+		double Built = Now();
+		gccollect();
+		double Marked = Now();
+		Live = NULL;
+		/* The most recent allocation is always kept alive */
+		gcmalloc(sizeof(long));
+		gccollect();
+		double Swept = Now();
+		
+		Building += Built - Start;
+		Marking  += Marked - Built;
+		Sweeping += Swept - Marked;
+	}
+	
+	printf("%d rounds of %ld objects: allocate %.1f ms, collect live %.1f ms, collect dead %.1f ms\n",
+		Rounds, Objects,
+		Building * 1e3 / Rounds,
+		Marking * 1e3 / Rounds,
+		Sweeping * 1e3 / Rounds);
+	
+	return 0;
+}
+
+static int RunChurn(int argc, char *argv[])
+{
+	long SlotCount = argc > 2 ? atol(argv[2]) : 20000;
+	long Steps = argc > 3 ? atol(argv[3]) : 2000000;
+	
+	if (SlotCount < 1 || Steps < 1) {
+		fprintf(stderr, "usage: %s churn [slots] [allocations]\n", argv[0]);
+		return 1;
+	}
+	
+	size_t Offsets[] = { 0 };
+	GCLayout *Pointers = gclayout(sizeof(void*), Offsets, 1);
+	GCLayout *Data = gclayout(sizeof(long), NULL, 0);
+	
+	void **Slots = gcmalloc_typed(sizeof(void*) * SlotCount, Pointers);
+	gcadd_root((void**)&Slots);
+	gcscan_stack(false);
+	
+	unsigned Seed = 1;
+	double Fragmentation = 0;
+	long Samples = 0;
+	double Start = Now();
+	
+	for (long i = 0; i < Steps; ++i) {
+		/* Mostly small objects, with an occasional large one */
+		size_t Size = rand_r(&Seed) % 16 == 0 ?
+			1024 + rand_r(&Seed) % (16 * 1024) :
+			16 + rand_r(&Seed) % 256;
+		
+		void *Buffer = gcmalloc_typed(Size, Data);
+		if (!Buffer) {
+			fprintf(stderr, "Out of memory\n");
+			abort();
+		}
+		
+		Slots[rand_r(&Seed) % SlotCount] = Buffer;
+		
+		if (i % 10000 == 0) {
+			GCStats Stats;
+			gcstats(&Stats);
+			Fragmentation += Stats.Fragmentation;
+			++Samples;
+		}
+	}
+	
+	double Elapsed = Now() - Start;
+	
+	printf("%ld allocations over %ld slots in %.3f s, %.1f ns each, mean fragmentation %.1f%%\n",
+		Steps, SlotCount, Elapsed, Elapsed * 1e9 / Steps,
+		Fragmentation * 100 / Samples);
+	
+	return 0;
+}
+
+static int RunFragment(int argc, char *argv[])
+{
+	long Rounds = argc > 2 ? atol(argv[2]) : 100;
+	long SlotCount = argc > 3 ? atol(argv[3]) : 20000;
+	
+	if (Rounds < 1 || SlotCount < 1) {
+		fprintf(stderr, "usage: %s fragment [rounds] [slots]\n", argv[0]);
+		return 1;
+	}
+	
+	size_t Offsets[] = { 0 };
+	GCLayout *Pointers = gclayout(sizeof(void*), Offsets, 1);
+	GCLayout *Data = gclayout(sizeof(long), NULL, 0);
+	
+	void **Slots = gcmalloc_typed(sizeof(void*) * SlotCount, Pointers);
+	gcadd_root((void**)&Slots);
+	gcscan_stack(false);
+	
+	unsigned Seed = 1;
+	long Grown = 0;
+	double Start = Now();
+	
+	for (long Round = 0; Round < Rounds; ++Round) {
+		for (long i = 0; i < SlotCount * 4; ++i) {
+			void *Buffer = gcmalloc_typed(16 + rand_r(&Seed) % 256, Data);
+			if (!Buffer) {
+				fprintf(stderr, "Out of memory\n");
+				abort();
+			}
+			
+			Slots[rand_r(&Seed) % SlotCount] = Buffer;
+		}
+		
+		GCStats Before;
+		gcstats(&Before);
+		
+		if (!gcmalloc_typed(LARGE_OBJECT, Data)) {
+			fprintf(stderr, "Out of memory\n");
+			abort();
+		}
+		
+		GCStats After;
+		gcstats(&After);
+		
+		if (After.HeapSize > Before.HeapSize && Before.FreeBytes > 2 * LARGE_OBJECT) {
+			++Grown;
+		}
+		
+		if ((Round + 1) % (Rounds / 10 ? Rounds / 10 : 1) == 0) {
+			printf("round %ld: heap %lu, free %lu, largest free block %lu\n",
+				Round + 1, Before.HeapSize, Before.FreeBytes,
+				Before.LargestFreeBlock);
+		}
+	}
+	
+	printf("%ld rounds in %.3f s, heap grew for %ld large objects\n",
+		Rounds, Now() - Start, Grown);
+	
+	return 0;
+}
+
+static int CompareDoubles(const void *First, const void *Second)
+{
+	double A = *(const double*)First;
+	double B = *(const double*)Second;
+	return (A > B) - (A < B);
+}
+
+static int RunLarge(int argc, char *argv[])
+{
+	long Size = argc > 2 ? atol(argv[2]) : LARGE_OBJECT;
+	long Count = argc > 3 ? atol(argv[3]) : 20000;
+	long KeptCount = argc > 4 ? atol(argv[4]) : 8;
+	
+	if (Size < 1 || Count < 1 || KeptCount < 1) {
+		fprintf(stderr, "usage: %s large [bytes] [allocations] [kept]\n", argv[0]);
+		return 1;
+	}
+	
+	size_t Offsets[] = { 0 };
+	GCLayout *Pointers = gclayout(sizeof(void*), Offsets, 1);
+	GCLayout *Data = gclayout(sizeof(long), NULL, 0);
+	
+	void **Kept = gcmalloc_typed(sizeof(void*) * KeptCount, Pointers);
+	gcadd_root((void**)&Kept);
+	double *Latencies = malloc(sizeof(double) * Count);
+	double Total = 0;
+	
+	for (long i = 0; i < Count; ++i) {
+		double Start = Now();
+		void *Buffer = gcmalloc_typed(Size, Data);
+		Latencies[i] = Now() - Start;
+		Total += Latencies[i];
+		
+		if (!Buffer) {
+			fprintf(stderr, "Out of memory\n");
+			abort();
+		}
+		
+		/* Use the object, as a program would */
+		memset(Buffer, 1, Size);
+		Kept[i % KeptCount] = Buffer;
+	}
+	
+	qsort(Latencies, Count, sizeof(double), CompareDoubles);
+	
+	printf("%ld allocations of %ld bytes: mean %.1f us, median %.1f us, 99th percentile %.1f us\n",
+		Count, Size,
+		Total * 1e6 / Count,
+		Latencies[Count / 2] * 1e6,
+		Latencies[Count * 99 / 100] * 1e6);
+	
+	free(Latencies);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int Result;
+	
+	if (argc > 1 && strcmp(argv[1], "cycle") == 0) {
+		Result = RunCycles(argc, argv);
+	}
+	else if (argc > 1 && strcmp(argv[1], "churn") == 0) {
+		Result = RunChurn(argc, argv);
+	}
+	else if (argc > 1 && strcmp(argv[1], "fragment") == 0) {
+		Result = RunFragment(argc, argv);
+	}
+	else if (argc > 1 && strcmp(argv[1], "large") == 0) {
+		Result = RunLarge(argc, argv);
+	}
+	else {
+		Result = RunThroughput(argc, argv);
+	}
+	
+	fflush(stdout);
+	gcdump_stats(STDOUT_FILENO);
+	
+	return Result;
+}
@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+
+size_t GCGetConfigSize(const char *Name, size_t Default)
+{
+	const char *Value = getenv(Name);
+	if (Value == NULL || *Value == '\0') {
+		return Default;
+	}
+	
+	char *End;
+	errno = 0;
+	unsigned long long Size = strtoull(Value, &End, 10);
+	
+	if (errno != 0 || End == Value) {
+		GCError("Invalid size for %s: %s", Name, Value);
+		return Default;
+	}
+	
+	switch (*End) {
+	case 'g': case 'G': Size *= 1024;  /* Fall through */
+	case 'm': case 'M': Size *= 1024;  /* Fall through */
+	case 'k': case 'K': Size *= 1024; ++End; break;
+	}
+	
+	if (*End != '\0') {
+		GCError("Invalid size for %s: %s", Name, Value);
+		return Default;
+	}
+	
+	return (size_t)Size;
+}
+
+long GCGetConfigInteger(const char *Name, long Default)
+{
+	const char *Value = getenv(Name);
+	if (Value == NULL || *Value == '\0') {
+		return Default;
+	}
+	
+	if (strcmp(Value, "off") == 0) {
+		return -1;
+	}
+	
+	char *End;
+	errno = 0;
+	long Integer = strtol(Value, &End, 10);
+	
+	if (errno != 0 || End == Value || *End != '\0') {
+		GCError("Invalid integer for %s: %s", Name, Value);
+		return Default;
+	}
+	
+	return Integer;
+}
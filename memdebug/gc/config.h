@@ -0,0 +1,23 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Collector settings are read from the environment so they
+ * can be tuned per deployment without rebuilding.
+ *
+ * GCGetConfigSize() accepts a byte count with an optional
+ * K, M or G suffix, e.g. GC_INITIAL_HEAP=64M.
+ * GCGetConfigInteger() accepts a plain decimal integer, or
+ * "off", which it reports as -1.
+ *
+ * Both return Default when the variable is unset, and
+ * report malformed values with GCError() before falling
+ * back to Default.
+ */
+size_t GCGetConfigSize(
+	const char *Name,
+	size_t      Default);
+
+long GCGetConfigInteger(
+	const char *Name,
+	long        Default);
@@ -1,33 +1,402 @@
 #include <assert.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "config.h"
+#include "gc.h"
 #include "list.h"
 #include "log.h"
+#include "stats.h"
+#include "thread.h"
+
+/*
+ * Free blocks keep two list links in their buffer, so no
+ * block is smaller than that. Blocks are aligned to and
+ * sized in multiples of a Granule.
+ */
+#define MinimumAllocationSize (2 * sizeof(void*))
+#define Granule               sizeof(void*)
+
+#define BitsPerWord (sizeof(uintptr_t) * 8)
+
+/*
+ * Small objects are carved out of per-thread allocation
+ * buffers of AllocationBufferSize bytes without taking the
+ * heap lock. Objects larger than MaximumBufferedSize are
+ * allocated from the free list directly.
+ */
+#define AllocationBufferSize (16 * 1024)
+#define MaximumBufferedSize  (AllocationBufferSize / 8)
+
+/*
+ * Objects of at least LargeObjectSize bytes (GC_LARGE_OBJECT,
+ * 128K by default) are mapped on their own instead.
+ */
+#define DefaultLargeObjectSize (128 * 1024)
+
+/*
+ * Compaction evacuates segments whose live objects fill
+ * less than 1 / CompactionOccupancy of them. Within such a
+ * segment, objects are pinned in pages of
+ * CompactionPageSize bytes: a page holding an object that
+ * is referenced ambiguously, or one too large to move,
+ * stays where it is.
+ */
+#define CompactionOccupancy 2
+#define CompactionPageSize  4096
+
+/*
+ * Free blocks large enough to become an allocation buffer
+ * are zeroed in the background after each collection, so
+ * that refills and large allocations find them clean.
+ */
+#define ZeroingMinimumSize (AllocationBufferSize - sizeof(GCObject))
+
+/*
+ * Protects the heap, the free lists and the roots.
+ * Collections hold it for their whole duration.
+ */
+static pthread_mutex_t HeapLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t InitializeOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * Free blocks are kept on intrusive doubly-linked lists,
+ * segregated by size: bin i holds blocks of 2^i to
+ * 2^(i+1) - 1 bytes. A block is unlinked in O(1), and
+ * NonEmptyBins finds the smallest bin whose blocks are all
+ * large enough without scanning.
+ */
+#define FreeBinCount 48
+
+typedef struct GCFreeLinks {
+	GCObject *Next;
+	GCObject *Previous;
+} GCFreeLinks;
+
+static GCObject *FreeBins[FreeBinCount];
+static uint64_t NonEmptyBins = 0;
+
+/*
+ * Objects that have been marked but whose children have
+ * not been scanned yet. Marking drains this stack instead
+ * of recursing, so deep object graphs cannot overflow the
+ * C stack.
+ */
+static GCList *MarkStack = NULL;
+
+/*
+ * The heap is a list of segments mapped with mmap(). Each
+ * segment starts with its GCSegment and its start bitmap,
+ * followed by blocks from Base to End, one after another
+ * with no gaps. Blocks never span segments.
+ *
+ * The start bitmap has one bit per granule of the block
+ * area, set where a block begins, so whether an address is
+ * an object can be answered without any search. Objects
+ * carved out of an allocation buffer get their bits when
+ * the buffer is retired; every buffer is retired before
+ * marking starts.
+ *
+ * LiveBytes is what the last sweep found live in the
+ * segment. Evacuating is set while a compaction moves the
+ * segment's objects out.
+ */
+typedef struct GCSegment GCSegment;
+
+typedef struct GCSegment {
+	char *Base;
+	char *End;
+	size_t Size;
+	size_t LiveBytes;
+	bool Evacuating;
+	GCSegment *Next;
+	uint64_t Starts[];
+} GCSegment;
+
+static GCSegment *Segments = NULL;
 
-#define MinimumAllocationSize (24 - sizeof(GCObject))
+/*
+ * The large-object space. Each large object has a mapping
+ * of its own, which starts with its GCObject and is
+ * unmapped when the object is swept, so large objects never
+ * fragment the segments. LargeObjects indexes them sorted by
+ * address, so whether an address is a large object is a
+ * binary search.
+ */
+static GCObject **LargeObjects = NULL;
+static size_t LargeObjectCount = 0;
+static size_t LargeObjectCapacity = 0;
+static size_t LargeObjectSize;
 
-static GCList *FreeBlocks = NULL;
-static GCList *UsedBlocks = NULL;
+/*
+ * Unmapping is slower than zeroing, so the mappings of
+ * swept large objects are kept until the next sweep, for
+ * allocations of the same size to reuse.
+ */
+#define LargeCacheSize 16
+static GCObject *LargeCache[LargeCacheSize];
+static size_t LargeCacheCount = 0;
 
-static void *MemoryBase = NULL;
-static void *MemoryEnd  = NULL;
+/*
+ * Collection policy, see malloc.h. A collection is started
+ * once AllocatedBytes reaches CollectionTrigger, which is
+ * CollectionPercent of the bytes that survived the last
+ * collection. CollectionPercent is negative when automatic
+ * collection is turned off.
+ */
+static size_t HeapSize = 0;
+static size_t LiveBytes = 0;
+static size_t AllocatedBytes = 0;
+static size_t CollectionTrigger = 0;
 
+static long   CollectionPercent;
+static size_t InitialHeapSize;
+static size_t MaximumHeapSize;
+static size_t MinimumTrigger;
+
+/*
+ * Counters kept by the collector under the heap lock.
+ * Allocation counts live in each GCThread and are added
+ * in when the statistics are read, and when the thread
+ * exits. GC_STATS_EVERY dumps them every that many
+ * collections.
+ */
+static GCStats Stats;
+static long StatsInterval;
+
+/*
+ * GC_COMPACT=N compacts the heap every N collections, see
+ * GCCompact(). The evacuator's allocation buffer is where
+ * moved objects are copied to.
+ */
+static long CompactionInterval;
+static GCThread Evacuator;
+
+/*
+ * Every block, used or free, starts with a GCObject.
+ *
+ * A block that follows a free block carries a boundary tag:
+ * GCFlagPreviousFree, and the free block's size including
+ * its header in PreviousSize, counted in granules. Freeing
+ * a block can then merge it with both neighbours in O(1).
+ * The tag lives in what would otherwise be padding, so it
+ * costs no memory. The sweep merges runs of dead blocks on
+ * its own; the tags are for blocks freed between sweeps,
+ * the unused tails of retired allocation buffers and the
+ * blocks the zeroing thread hands back.
+ *
+ * Marking pins objects found through ambiguous references,
+ * which compaction must not move. An object that has been
+ * moved is left behind as a free block with
+ * GCFlagForwarded set and its new address in the first
+ * word of its buffer, until references to it are updated.
+ *
+ * A free block with GCFlagClean set is known to be zero,
+ * apart from its list links, so allocating from it needs
+ * no memset. Fresh segments start out clean, and dirty
+ * blocks are zeroed by the zeroing thread, which takes them
+ * off the free lists and marks them GCFlagZeroing meanwhile.
+ *
+ * GCFlagPointerFree is set on objects whose layout has no
+ * pointers, which marking never scans. GCFlagLarge is set on
+ * objects in the large-object space.
+ */
 typedef struct GCObject {
 	size_t Size;
-	bool Marked;
+	const GCLayout *Layout;
+	uint32_t Flags;
+	uint32_t PreviousSize;
 } GCObject;
 
+#define GCFlagMarked       0x1
+#define GCFlagFree         0x2
+#define GCFlagPreviousFree 0x4
+#define GCFlagPinned       0x8
+#define GCFlagForwarded    0x10
+#define GCFlagClean        0x20
+#define GCFlagZeroing      0x40
+#define GCFlagPointerFree  0x80
+#define GCFlagLarge        0x100
+
+typedef struct GCLayout {
+	size_t Words;
+	size_t PointerCount;
+	uintptr_t Bitmap[];
+} GCLayout;
+
+/*
+ * A registered root. A precise root is a single slot
+ * holding NULL or a buffer; a range is scanned
+ * conservatively.
+ */
+typedef struct GCRoot {
+	void *Base;
+	size_t Size;
+	bool Precise;
+} GCRoot;
+
+static GCRoot *Roots = NULL;
+static size_t RootCount = 0;
+static size_t RootCapacity = 0;
+
+static bool ScanStack = true;
+
+/*
+ * A weak reference. Target is cleared by the collection
+ * that finds it otherwise unreachable. Handles live on an
+ * intrusive list so they can be unlinked in O(1).
+ */
+typedef struct GCWeak GCWeak;
+
+typedef struct GCWeak {
+	void *Target;
+	GCWeak *Previous;
+	GCWeak *Next;
+} GCWeak;
+
+static GCWeak *WeakReferences = NULL;
+
+/*
+ * A finalizer waits on Finalizers until its object is found
+ * unreachable. The collector then moves it to
+ * PendingFinalizers and keeps the object, and everything it
+ * references, alive until the finalizer thread has run it.
+ * The finalizer thread takes a whole batch at a time, and
+ * RunningFinalizers holds that batch so it stays rooted.
+ * All three lists are protected by the heap lock.
+ */
+typedef struct GCFinalizer GCFinalizer;
+
+typedef struct GCFinalizer {
+	GCObject *Object;
+	GCFinalizerFunction Function;
+	void *Context;
+	GCFinalizer *Next;
+} GCFinalizer;
+
+static GCFinalizer *Finalizers = NULL;
+static GCFinalizer *PendingFinalizers = NULL;
+static GCFinalizer *RunningFinalizers = NULL;
+
+static pthread_once_t FinalizerThreadOnce = PTHREAD_ONCE_INIT;
+static pthread_cond_t FinalizersReady = PTHREAD_COND_INITIALIZER;
+
+/*
+ * The zeroing thread waits on ZeroingReady until a
+ * collection has left dirty free blocks. It is off on a
+ * single processor, where it could only take time from the
+ * mutators.
+ */
+static bool BackgroundZeroing;
+static pthread_once_t ZeroingThreadOnce = PTHREAD_ONCE_INIT;
+static pthread_cond_t ZeroingReady = PTHREAD_COND_INITIALIZER;
+
 static void GCInitialize();
-static void GCFreeByIndex(GCObject *Object, size_t Index);
+static void GCInitializeOnce();
+static GCObject *GCAllocLocked(GCThread *Thread, size_t Size);
+static GCObject *GCAllocFromHeap(GCThread *Thread, size_t Size);
+static GCObject *GCAllocLarge(size_t Size);
+static GCObject *GCFindLargeObject(void *Buffer);
+static void GCSweepLargeObjects();
+static GCObject *GCTakeFreeBlock(size_t Size);
+static GCObject *GCAllocBuffered(GCThread *Thread, size_t Size);
+static bool GCRefillBuffer(GCThread *Thread, size_t Size);
+static void GCRetireBuffer(GCThread *Thread);
+static void GCInitializeObject(GCObject *Object, const GCLayout *Layout);
 static void GCMarkObject(GCObject *Object);
+static void GCMarkAmbiguous(void *Pointer);
+static void GCMarkPrecise(void *Pointer);
+static void GCScanObject(GCObject *Object);
+static void GCScanRange(void **Begin, void **End);
+static void GCPinRange(void **Begin, void **End);
+static void GCScanRoots();
+static void GCScanStack(GCThread *Thread, void (*Visit)(void **Begin, void **End));
+static void GCDrainMarkStack();
+static void GCPushRoot(void *Base, size_t Size, bool Precise);
 static void GCSweep();
-static void GCCompactBlocks(GCList *List);
-static void GCReportBlocks(const GCList *List);
+static size_t GCSweepSegment(GCSegment *Segment);
+static void GCCompact();
+static bool GCEvacuate(GCObject *Object);
+static void GCForward(void **Slot);
+static void GCForwardObject(GCObject *Object);
+static void GCUpdateReferences();
+static void GCReportBlocks(bool Free);
+static void GCPushFree(GCSegment *Segment, GCObject *Block);
+static void GCUnlinkFree(GCObject *Block);
+static void GCFreeBlock(GCSegment *Segment, GCObject *Block);
+static void GCSetStart(GCSegment *Segment, GCObject *Object, bool Start);
 static bool IsGCBuffer(void *Buffer);
+static void GCCountAllocation(GCThread *Thread, GCObject *Object);
+static void GCClearWeakReferences();
+static void GCQueueFinalizers();
+static void GCMarkFinalizers(GCFinalizer *List);
+static void GCStartFinalizerThread();
+static void *GCRunFinalizers(void *Argument);
+static void GCStartZeroingThread();
+static void *GCRunZeroing(void *Argument);
+static GCObject *GCTakeDirtyBlock();
+static void GCZero(void *Buffer, size_t Size);
+static void GCGetStatsLocked(GCStats *Result);
+static GCSegment *GCFindSegment(void *Address);
+static bool GCAddSegment(size_t Size);
+static bool GCGrowHeap(size_t Needed);
+static void GCUpdateTrigger();
+static void GCCollectLocked();
+
+static inline GCFreeLinks *GCLinks(GCObject *Block)
+{
+	return GCGetBuffer(Block);
+}
+
+static inline size_t GCBinIndex(size_t Size)
+{
+	size_t Bin = 63 - __builtin_clzl(Size);
+	return Bin < FreeBinCount ? Bin : FreeBinCount - 1;
+}
+
+/*
+ * Returns the block after Block, or NULL if Block is the
+ * last one in its segment.
+ */
+static inline GCObject *GCNextBlock(GCSegment *Segment, GCObject *Block)
+{
+	char *Next = (char*)GCGetBuffer(Block) + Block->Size;
+	return Next < Segment->End ? (GCObject*)Next : NULL;
+}
+
+/*
+ * Grows Block over Next, the free block after it. The
+ * result stays clean only if both were, and then Next's
+ * header and links, now inside it, are zeroed.
+ */
+static inline void GCAbsorb(GCObject *Block, GCObject *Next)
+{
+	Block->Size += sizeof(GCObject) + Next->Size;
+	
+	if (Block->Flags & Next->Flags & GCFlagClean) {
+		memset(Next, 0, sizeof(GCObject) + sizeof(GCFreeLinks));
+	}
+	else {
+		Block->Flags &= ~GCFlagClean;
+	}
+}
+
+static inline bool GCIsStart(GCSegment *Segment, GCObject *Object)
+{
+	size_t Index = ((char*)Object - Segment->Base) / Granule;
+	return (Segment->Starts[Index / 64] >> (Index % 64)) & 1;
+}
 
 void *GCGetBuffer(GCObject *Object)
 {
@@ -39,271 +408,1905 @@ GCObject *GCGetObject(void *Buffer)
 	return ((GCObject*)Buffer) - 1;
 }
 
+GCLayout *GCCreateLayout(
+	size_t        Size,
+	const size_t *PointerOffsets,
+	size_t        PointerCount)
+{
+	size_t Words = (Size + sizeof(void*) - 1) / sizeof(void*);
+	if (Words == 0) {
+		Words = 1;
+	}
+	
+	size_t BitmapWords = (Words + BitsPerWord - 1) / BitsPerWord;
+	GCLayout *Layout = calloc(1, sizeof(GCLayout) +
+		BitmapWords * sizeof(uintptr_t));
+	assert(Layout);
+	
+	Layout->Words = Words;
+	
+	for (size_t i = 0; i < PointerCount; ++i) {
+		assert(PointerOffsets[i] % sizeof(void*) == 0);
+		assert(PointerOffsets[i] < Words * sizeof(void*));
+		
+		size_t Word = PointerOffsets[i] / sizeof(void*);
+		uintptr_t Bit = (uintptr_t)1 << (Word % BitsPerWord);
+		
+		if (!(Layout->Bitmap[Word / BitsPerWord] & Bit)) {
+			Layout->Bitmap[Word / BitsPerWord] |= Bit;
+			++Layout->PointerCount;
+		}
+	}
+	
+	return Layout;
+}
+
 GCObject *GCAlloc(size_t Size)
+{
+	return GCAllocTyped(Size, NULL);
+}
+
+GCObject *GCAllocTyped(size_t Size, const GCLayout *Layout)
 {
 	GCDebug("Size = %lu", Size);
 	Size = Size < MinimumAllocationSize ? 
 		MinimumAllocationSize : Size;
-	if (Size % 8 != 0) {
-		Size += (Size % 8);
-	}
+	Size = (Size + 7) & ~(size_t)7;
 	GCDebug("Adjusted size = %lu", Size);
 	
 	GCInitialize();
+	GCThread *Thread = GCCurrentThread();
+	GCObject *Object = NULL;
 	
-	size_t ListSize = GCQueryListSize(FreeBlocks);
-	for (size_t i = 0; i < ListSize; ++i) {
-		GCObject *Object = GCGetListEntry(FreeBlocks, i);
+	if (Size <= MaximumBufferedSize) {
+		GCEnterNoSuspend(Thread);
 		
-		if (Size < Object->Size) {
-			GCPopList(FreeBlocks, i);
-			
-			GCDebug("Found object %p with size = %lu",
-				Object, Object->Size);
-			
-			if (MinimumAllocationSize < Object->Size - Size)
-			{
-				GCDebug("Splitting object %p", Object);
-				GCObject *Next = (GCObject*)((char*)GCGetBuffer(Object) + Size);
-				GCDebug("++ New object at %p", Next);
-				Next->Size = Object->Size - Size - sizeof(GCObject);
-				GCDebug("++ New object size is %lu", Next->Size);
-				Object->Size -= (Next->Size + sizeof(GCObject));
-				GCDebug("++ Found object size is now %lu", Object->Size);
-					
-				GCPushList(FreeBlocks, Next);
-			}
-			
-			Object->Marked = false;
-			memset(GCGetBuffer(Object), 0, Object->Size);
-			GCPushList(UsedBlocks, Object);
-			
+		Object = GCAllocBuffered(Thread, Size);
+		if (Object) {
+			GCInitializeObject(Object, Layout);
+			GCCountAllocation(Thread, Object);
+			Thread->LastObject = Object;
+		}
+		
+		GCLeaveNoSuspend(Thread);
+		
+		if (Object) {
 			return Object;
 		}
 	}
 	
-	GCError("Unable to allocate %lu bytes.", Size);
-	return NULL;
+	pthread_mutex_lock(&HeapLock);
+	
+	Object = GCAllocLocked(Thread, Size);
+	
+	if (Object) {
+		GCInitializeObject(Object, Layout);
+		GCCountAllocation(Thread, Object);
+		Thread->LastObject = Object;
+	}
+	
+	pthread_mutex_unlock(&HeapLock);
+	
+	if (!Object) {
+		GCEvent(GCEventAllocFailed, Size, 0);
+		GCError("Unable to allocate %lu bytes.", Size);
+	}
+	
+	return Object;
 }
 
-void GCReportBlocks(const GCList *List)
+/*
+ * The allocation slow path. Collects when enough has been
+ * allocated since the last collection, or when the heap
+ * cannot satisfy the request, even with GC_PERCENT=off, and
+ * grows the heap only when collecting did not free enough.
+ * The caller must hold the heap lock.
+ */
+GCObject *GCAllocLocked(GCThread *Thread, size_t Size)
 {
-	size_t ListSize = GCQueryListSize(List);
-	for (size_t i = 0; i < ListSize; ++i) {
-		GCObject *Object = GCGetListEntry(List, i);
-		GCTrace("++ Object: %p, Size: %lu", 
-			Object, 
-			Object->Size);
+	bool Automatic = CollectionPercent >= 0;
+	bool Collected = false;
+	
+	if (Automatic && AllocatedBytes >= CollectionTrigger) {
+		GCDebug("Allocated %lu bytes since the last collection",
+			AllocatedBytes);
+		GCCollectLocked();
+		Collected = true;
+	}
+	
+	GCObject *Object = GCAllocFromHeap(Thread, Size);
+	
+	if (!Object && !Collected) {
+		GCCollectLocked();
+		Object = GCAllocFromHeap(Thread, Size);
+	}
+	
+	if (!Object && Size < LargeObjectSize) {
+		size_t Needed = Size <= MaximumBufferedSize ?
+			AllocationBufferSize : sizeof(GCObject) + Size;
+		
+		if (GCGrowHeap(Needed)) {
+			Object = GCAllocFromHeap(Thread, Size);
+		}
 	}
+	
+	return Object;
 }
 
-void GCListUsedObjects()
+GCObject *GCAllocFromHeap(GCThread *Thread, size_t Size)
 {
-	GCTrace("Used Objects");
-	GCReportBlocks(UsedBlocks);
+	if (Size <= MaximumBufferedSize) {
+		if (!GCRefillBuffer(Thread, Size)) {
+			return NULL;
+		}
+		
+		GCObject *Object = GCAllocBuffered(Thread, Size);
+		assert(Object);
+		GCEvent(GCEventRefill, Thread->AllocStart, Thread->AllocEnd - Thread->AllocStart);
+		return Object;
+	}
+	
+	if (Size >= LargeObjectSize) {
+		return GCAllocLarge(Size);
+	}
+	
+	GCObject *Object = GCTakeFreeBlock(Size);
+	if (Object) {
+		AllocatedBytes += sizeof(GCObject) + Object->Size;
+		GCEvent(GCEventLargeAlloc, Object, Object->Size);
+	}
+	
+	return Object;
 }
 
-void GCListFreeObjects()
+/*
+ * Maps a large object, or reuses a cached mapping, and adds
+ * it to the index. Fails when a new mapping would grow the
+ * heap past GC_MAX_HEAP.
+ * The caller must hold the heap lock.
+ */
+GCObject *GCAllocLarge(size_t Size)
 {
-	GCTrace("Free Objects");
-	GCReportBlocks(FreeBlocks);
+	size_t PageSize = sysconf(_SC_PAGESIZE);
+	size_t Mapped = (sizeof(GCObject) + Size + PageSize - 1) & ~(PageSize - 1);
+	if (LargeObjectCount == LargeObjectCapacity) {
+		size_t Capacity = LargeObjectCapacity ? LargeObjectCapacity * 2 : 64;
+		GCObject **Index = realloc(LargeObjects, sizeof(GCObject*) * Capacity);
+		if (!Index) {
+			return NULL;
+		}
+		
+		LargeObjects = Index;
+		LargeObjectCapacity = Capacity;
+	}
+	
+	GCObject *Object = NULL;
+	
+	for (size_t i = 0; i < LargeCacheCount; ++i) {
+		if (sizeof(GCObject) + LargeCache[i]->Size == Mapped) {
+			Object = LargeCache[i];
+			LargeCache[i] = LargeCache[--LargeCacheCount];
+			break;
+		}
+	}
+	
+	if (!Object && MaximumHeapSize != 0 && HeapSize + Mapped > MaximumHeapSize) {
+		GCDebug("A large object of %lu bytes would exceed the maximum heap size",
+			Size);
+		return NULL;
+	}
+	
+	if (Object) {
+		Object->Flags = GCFlagLarge;
+	}
+	else {
+		Object = mmap(NULL, Mapped, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (Object == MAP_FAILED) {
+			GCError("Unable to map a large object of %lu bytes.", Size);
+			return NULL;
+		}
+		
+		Object->Size = Mapped - sizeof(GCObject);
+		Object->Flags = GCFlagLarge | GCFlagClean;
+		HeapSize += Mapped;
+	}
+	
+	size_t Low = 0;
+	size_t High = LargeObjectCount;
+	while (Low < High) {
+		size_t Middle = (Low + High) / 2;
+		if (LargeObjects[Middle] < Object) {
+			Low = Middle + 1;
+		}
+		else {
+			High = Middle;
+		}
+	}
+	
+	memmove(&LargeObjects[Low + 1], &LargeObjects[Low],
+		sizeof(GCObject*) * (LargeObjectCount - Low));
+	LargeObjects[Low] = Object;
+	++LargeObjectCount;
+	
+	AllocatedBytes += Mapped;
+	GCEvent(GCEventLargeAlloc, Object, Object->Size);
+	
+	return Object;
 }
 
-void GCInitialize()
+/*
+ * Returns the large object whose buffer is Buffer, or NULL.
+ */
+GCObject *GCFindLargeObject(void *Buffer)
 {
-	static bool Initialized = false;
+	if (LargeObjectCount == 0) {
+		return NULL;
+	}
 	
-	if (!Initialized) {
-		FreeBlocks = GCCreateList();
-		UsedBlocks = GCCreateList();
+	GCObject *Object = GCGetObject(Buffer);
+	if (Object < LargeObjects[0] || Object > LargeObjects[LargeObjectCount - 1]) {
+		return NULL;
+	}
 	
-		size_t MemorySize = 1024 * 1024;
-		size_t ByteCount = sizeof(GCObject) + MemorySize;
-		
-		GCObject *Block = malloc(ByteCount);
-		assert(Block);
-		
-		MemoryBase = Block;
-		MemoryEnd = Block + ByteCount;
-		
-		Block->Size = MemorySize;
-		GCPushList(FreeBlocks, Block);
-		
-		Initialized = true;
+	size_t Low = 0;
+	size_t High = LargeObjectCount;
+	while (Low < High) {
+		size_t Middle = (Low + High) / 2;
+		if (LargeObjects[Middle] < Object) {
+			Low = Middle + 1;
+		}
+		else {
+			High = Middle;
+		}
 	}
+	
+	return Low < LargeObjectCount && LargeObjects[Low] == Object ? Object : NULL;
 }
 
-void GCFreeByIndex(GCObject *Object, size_t Index)
+/*
+ * Only the owning thread writes its counters, so plain
+ * increments suffice; the relaxed stores only keep
+ * concurrent readers from seeing torn values.
+ */
+void GCCountAllocation(GCThread *Thread, GCObject *Object)
 {
-	assert(Object);
+	__atomic_store_n(&Thread->AllocatedBytes,
+		Thread->AllocatedBytes + sizeof(GCObject) + Object->Size,
+		__ATOMIC_RELAXED);
+	__atomic_store_n(&Thread->AllocatedObjects,
+		Thread->AllocatedObjects + 1,
+		__ATOMIC_RELAXED);
+}
+
+void GCInitializeObject(GCObject *Object, const GCLayout *Layout)
+{
+	if (!(Object->Flags & GCFlagClean)) {
+		memset(GCGetBuffer(Object), 0, Object->Size);
+	}
 	
-	GCTrace("Freeing object %p with size %lu", 
-		Object, Object->Size);
-		
-	GCPopList(UsedBlocks, Index);
-	GCPushList(FreeBlocks, Object);
+	Object->Layout = Layout;
+	Object->Flags &= GCFlagLarge;
+	
+	if (Layout && Layout->PointerCount == 0) {
+		Object->Flags |= GCFlagPointerFree;
+	}
 }
 
-void GCMarkObject(GCObject *Object)
+/*
+ * Removes the first free block that can hold Size bytes
+ * from the free list, splitting off what it does not need.
+ * A clean block is returned with GCFlagClean still set and
+ * its whole buffer zero.
+ * The caller must hold the heap lock.
+ */
+GCObject *GCTakeFreeBlock(size_t Size)
 {
-	assert(Object);
+	/*
+	 * Every block in a bin above Size's is large enough, so
+	 * take the first one there. Only when those bins are
+	 * empty search Size's own bin for a block that fits.
+	 */
+	size_t Bin = GCBinIndex(Size);
+	uint64_t Larger = Bin + 1 < FreeBinCount ?
+		NonEmptyBins & ~(((uint64_t)2 << Bin) - 1) : 0;
+	GCObject *Object = NULL;
+		
+	if (Larger) {
+		Object = FreeBins[__builtin_ctzll(Larger)];
+	}
+	else {
+		for (Object = FreeBins[Bin]; Object; Object = GCLinks(Object)->Next) {
+			if (Size <= Object->Size) {
+				break;
+			}
+		}
+	}
 	
-	GCDebug("Marking object %p", Object);
+	if (!Object) {
+		return NULL;
+	}
 	
-	Object->Marked = true;
+	GCSegment *Segment = GCFindSegment(Object);
 	
-	void **Buffer = GCGetBuffer(Object);
+	GCUnlinkFree(Object);
+	Object->Flags &= GCFlagClean;
+	
+	if (Object->Flags & GCFlagClean) {
+		memset(GCLinks(Object), 0, sizeof(GCFreeLinks));
+	}
+	
+	GCDebug("Found object %p with size = %lu",
+		Object, Object->Size);
 	
-	for (size_t i = 0; i < Object->Size / sizeof(void*); ++i)
+	if (MinimumAllocationSize + sizeof(GCObject) <=
+		Object->Size - Size)
 	{
-		if (IsGCBuffer(Buffer[i])) {
-			GCObject *Child = GCGetObject(Buffer[i]);
-			
-			GCDebug("++ Found child object %p", Child);
-			
-			if (!Child->Marked) {
-				GCMarkObject(Child);
-			}
+		GCDebug("Splitting object %p", Object);
+		GCObject *Next = (GCObject*)((char*)GCGetBuffer(Object) + Size);
+		Next->Size = Object->Size - Size - sizeof(GCObject);
+		Next->Flags = Object->Flags;
+		Object->Size = Size;
+		
+		GCSetStart(Segment, Next, true);
+		GCPushFree(Segment, Next);
+	}
+	else {
+		GCObject *Next = GCNextBlock(Segment, Object);
+		if (Next) {
+			Next->Flags &= ~GCFlagPreviousFree;
 		}
 	}
+	
+	return Object;
 }
 
-void GCSweep()
+/*
+ * Puts Block on its free list and tags the block after it.
+ * A free block never follows another free block, so
+ * Block's own tag is cleared. GCFlagClean is kept.
+ */
+void GCPushFree(GCSegment *Segment, GCObject *Block)
 {
-	GCPinList(UsedBlocks);
-	size_t ListSize = GCQueryListSize(UsedBlocks);
+	size_t Bin = GCBinIndex(Block->Size);
+	GCFreeLinks *Links = GCLinks(Block);
 	
-	for (size_t i = 0; i < ListSize; ++i) {
-		GCObject *Object = GCGetListEntry(UsedBlocks, i);
-		if (Object->Marked) {
-			Object->Marked = false;
-		}
-		else {
-			GCFreeByIndex(Object, i);
+	GCObject *Next = GCNextBlock(Segment, Block);
+	if (Next) {
+		Next->Flags |= GCFlagPreviousFree;
+		Next->PreviousSize = (sizeof(GCObject) + Block->Size) / Granule;
+	}
+	
+	Block->Flags = GCFlagFree | (Block->Flags & GCFlagClean);
+	Links->Previous = NULL;
+	Links->Next = FreeBins[Bin];
+	if (Links->Next) {
+		GCLinks(Links->Next)->Previous = Block;
+	}
+	
+	FreeBins[Bin] = Block;
+	NonEmptyBins |= (uint64_t)1 << Bin;
+}
+
+void GCUnlinkFree(GCObject *Block)
+{
+	size_t Bin = GCBinIndex(Block->Size);
+	GCFreeLinks *Links = GCLinks(Block);
+	
+	if (Links->Previous) {
+		GCLinks(Links->Previous)->Next = Links->Next;
+	}
+	else {
+		FreeBins[Bin] = Links->Next;
+		if (!Links->Next) {
+			NonEmptyBins &= ~((uint64_t)1 << Bin);
 		}
 	}
 	
-	GCUnpinList(UsedBlocks);
+	if (Links->Next) {
+		GCLinks(Links->Next)->Previous = Links->Previous;
+	}
 }
 
-bool IsGCBuffer(void *Buffer)
+/*
+ * Frees a block that is not on a free list, merging it
+ * with a free block on either side.
+ */
+void GCFreeBlock(GCSegment *Segment, GCObject *Block)
 {
-	if (Buffer == NULL) {
-		return false;
+	GCObject *Next = GCNextBlock(Segment, Block);
+	if (Next && (Next->Flags & GCFlagFree) && !(Next->Flags & GCFlagZeroing)) {
+		GCUnlinkFree(Next);
+		GCSetStart(Segment, Next, false);
+		GCAbsorb(Block, Next);
 	}
 	
-	if (MemoryBase < Buffer && Buffer < MemoryEnd)
-	{
-		GCObject *Object = GCGetObject(Buffer);
-		size_t Index = GCIndexOfList(UsedBlocks, Object);
-		return Index != GCNoSuchObject;
+	if (Block->Flags & GCFlagPreviousFree) {
+		GCObject *Previous = (GCObject*)
+			((char*)Block - Block->PreviousSize * Granule);
+		assert(Previous->Flags & GCFlagFree);
+		
+		GCUnlinkFree(Previous);
+		GCSetStart(Segment, Block, false);
+		GCAbsorb(Previous, Block);
+		Block = Previous;
 	}
 	
-	return false;
+	GCPushFree(Segment, Block);
 }
 
-static void GCCompactBlocks(GCList *List)
+void GCSetStart(GCSegment *Segment, GCObject *Object, bool Start)
 {
-	assert(List);
+	size_t Index = ((char*)Object - Segment->Base) / Granule;
+	uint64_t Bit = (uint64_t)1 << (Index % 64);
 	
-	GCSortList(List);
-	GCPinList(List);
+	if (Start) {
+		Segment->Starts[Index / 64] |= Bit;
+	}
+	else {
+		Segment->Starts[Index / 64] &= ~Bit;
+	}
+}
+
+/*
+ * Carves an object out of the thread's allocation buffer.
+ * Only the owning thread calls this, either inside a
+ * no-suspend section or while holding the heap lock.
+ */
+GCObject *GCAllocBuffered(GCThread *Thread, size_t Size)
+{
+	char *Cursor = Thread->AllocCursor;
+	size_t Needed = sizeof(GCObject) + Size;
 	
-	size_t ListSize = GCQueryListSize(List);
+	if (Cursor == NULL || (size_t)(Thread->AllocEnd - Cursor) < Needed) {
+		return NULL;
+	}
 	
-	if (ListSize < 2) {
-		return;
+	/*
+	 * The rest of the buffer must stay large enough to
+	 * become a free block when the buffer is retired.
+	 */
+	size_t Rest = Thread->AllocEnd - Cursor - Needed;
+	if (Rest < sizeof(GCObject) + MinimumAllocationSize) {
+		Size += Rest;
 	}
 	
-	GCObject *Current = GCGetListEntry(List, 0);
-	size_t NextIndex = 1;
+	GCObject *Object = (GCObject*)Cursor;
+	Object->Size = Size;
+	Object->Flags = Thread->AllocClean ? GCFlagClean : 0;
+	Thread->AllocCursor = Cursor + sizeof(GCObject) + Size;
 	
-	for (; NextIndex < ListSize; ++NextIndex)
-	{
-		GCObject *Next = GCGetListEntry(List, NextIndex);
-		size_t Offset = sizeof(GCObject) + Current->Size;
-		if ((char*)Current + Offset == (char*)Next) {
-			GCTrace("Combining object %p of size %lu with"
-				    " object %p of size %lu.",
-					Current, Current->Size,
-					Next, Next->Size);
-					
-			Current->Size += Offset;
-			GCPopList(List, NextIndex);
-		}
-		else {
-			Current = Next;
+	return Object;
+}
+
+/*
+ * Retires the thread's allocation buffer and takes a new
+ * one that can hold at least Size bytes.
+ * The caller must hold the heap lock.
+ */
+bool GCRefillBuffer(GCThread *Thread, size_t Size)
+{
+	GCRetireBuffer(Thread);
+	
+	GCObject *Block = GCTakeFreeBlock(AllocationBufferSize - sizeof(GCObject));
+	
+	/*
+	 * Short of a whole buffer, take the first block of the
+	 * largest bin, not the smallest block that fits: a
+	 * fragmented heap would otherwise refill once per object.
+	 */
+	if (!Block && NonEmptyBins) {
+		GCObject *Largest = FreeBins[63 - __builtin_clzll(NonEmptyBins)];
+		if (Size <= Largest->Size) {
+			Block = GCTakeFreeBlock(Largest->Size);
 		}
 	}
 	
-	GCUnpinList(List);
+	if (!Block) {
+		Block = GCTakeFreeBlock(Size);
+	}
+	
+	if (!Block) {
+		return false;
+	}
+	
+	Thread->AllocStart  = (char*)Block;
+	Thread->AllocCursor = (char*)Block;
+	Thread->AllocEnd    = (char*)GCGetBuffer(Block) + Block->Size;
+	Thread->AllocClean  = Block->Flags & GCFlagClean;
+	
+	/*
+	 * The whole buffer counts as allocated until it is
+	 * retired and the unused rest is handed back.
+	 */
+	AllocatedBytes += Thread->AllocEnd - Thread->AllocStart;
+	
+	return true;
 }
 
-static void *GetStackBase()
+/*
+ * Hands the objects carved out of the thread's allocation
+ * buffer to the collector and frees the unused rest. The
+ * caller must hold the heap lock, and the thread must be
+ * the caller or suspended.
+ */
+void GCRetireBuffer(GCThread *Thread)
 {
-	const char *Format =
-		"%*d %*s %*c %*d %*d %*d %*d %*d %*u %*lu "
-		"%*lu %*lu %*lu %*lu %*lu %*ld %*ld %*ld %*ld %*ld "
-		"%*ld %*llu %*lu %*ld %*lu %*lu %*lu %lu %*lu %*lu ";
-
-	FILE *Stat = fopen("/proc/self/stat", "r");
-	assert(Stat);
+	if (Thread->AllocStart == NULL) {
+		return;
+	}
 	
-	uint64_t StackBase = 0;
+	GCSegment *Segment = GCFindSegment(Thread->AllocStart);
 	
-	if (fscanf(Stat, Format, &StackBase) != 1) {
-		assert(false);
+	char *Cursor = Thread->AllocStart;
+	while (Cursor < Thread->AllocCursor) {
+		GCObject *Object = (GCObject*)Cursor;
+		GCSetStart(Segment, Object, true);
+		Cursor += sizeof(GCObject) + Object->Size;
 	}
 	
-	fclose(Stat);
+	if (Cursor < Thread->AllocEnd) {
+		GCObject *Rest = (GCObject*)Cursor;
+		Rest->Size = Thread->AllocEnd - Cursor - sizeof(GCObject);
+		Rest->Flags = Thread->AllocClean ? GCFlagClean : 0;
+		GCSetStart(Segment, Rest, true);
+		GCFreeBlock(Segment, Rest);
+		
+		size_t Unused = Thread->AllocEnd - Cursor;
+		AllocatedBytes -= Unused < AllocatedBytes ? Unused : AllocatedBytes;
+	}
 	
-	return (void*)StackBase;
+	Thread->AllocStart  = NULL;
+	Thread->AllocCursor = NULL;
+	Thread->AllocEnd    = NULL;
 }
 
-void GCCollect()
+void GCReleaseThread(GCThread *Thread)
 {
-	register void *rsp asm("rsp");
-	void *StackBase = GetStackBase();
-			
-	void **Stack = rsp + ((uintptr_t)rsp % sizeof(void*));
+	pthread_mutex_lock(&HeapLock);
+	GCRetireBuffer(Thread);
 	
-	GCDebug("rsp is %p and the stack base is %p",
-		rsp,
-		StackBase);
-	GCDebug("Scanning from %p", Stack);
+	/*
+	 * The thread stays in the thread list a little
+	 * longer, so clear its counters once they are kept
+	 * here to avoid counting them twice.
+	 */
+	Stats.AllocatedBytes   += Thread->AllocatedBytes;
+	Stats.AllocatedObjects += Thread->AllocatedObjects;
+	__atomic_store_n(&Thread->AllocatedBytes, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&Thread->AllocatedObjects, 0, __ATOMIC_RELAXED);
 	
-	for (; (void*)Stack < StackBase; ++Stack)
-	{
-		if (IsGCBuffer(*Stack)) {
-			GCObject *Object = GCGetObject(*Stack);
-			GCMarkObject(Object);
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCGetStats(GCStats *Result)
+{
+	GCInitialize();
+	
+	pthread_mutex_lock(&HeapLock);
+	GCGetStatsLocked(Result);
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCGetStatsLocked(GCStats *Result)
+{
+	*Result = Stats;
+	
+	GCLockThreads();
+	for (GCThread *Thread = GCFirstThread(); Thread; Thread = Thread->Next) {
+		Result->AllocatedBytes +=
+			__atomic_load_n(&Thread->AllocatedBytes, __ATOMIC_RELAXED);
+		Result->AllocatedObjects +=
+			__atomic_load_n(&Thread->AllocatedObjects, __ATOMIC_RELAXED);
+	}
+	GCUnlockThreads();
+	
+	Result->HeapSize  = HeapSize;
+	Result->LiveBytes = LiveBytes;
+	
+	for (size_t Bin = 0; Bin < FreeBinCount; ++Bin) {
+		for (GCObject *Block = FreeBins[Bin]; Block; Block = GCLinks(Block)->Next) {
+			Result->FreeBytes += Block->Size;
+			if (Block->Size > Result->LargestFreeBlock) {
+				Result->LargestFreeBlock = Block->Size;
+			}
 		}
 	}
 	
-	register void *r12 asm("r12");
-	register void *r13 asm("r13");
-	register void *r14 asm("r14");
-	register void *r15 asm("r15");
-	register void *rdi asm("rdi");
-	register void *rsi asm("rsi");
-	register void *rbx asm("rbx");
-	register void *rbp asm("rbp");
+	Result->Fragmentation = Result->FreeBytes ?
+		1 - (double)Result->LargestFreeBlock / Result->FreeBytes : 0;
+}
+
+/*
+ * Walks the heap and reports either the used or the free
+ * blocks. Other threads' allocation buffers are skipped:
+ * they are still being carved up and cannot be walked.
+ * The caller must hold the heap lock.
+ */
+void GCReportBlocks(bool Free)
+{
+	GCLockThreads();
+	
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		char *Cursor = Segment->Base;
+		
+		while (Cursor < Segment->End) {
+			GCThread *Owner = GCFirstThread();
+			while (Owner && Owner->AllocStart != Cursor) {
+				Owner = Owner->Next;
+			}
+			
+			if (Owner) {
+				Cursor = Owner->AllocEnd;
+				continue;
+			}
+			
+			GCObject *Object = (GCObject*)Cursor;
+			if (!(Object->Flags & GCFlagFree) == !Free) {
+				GCInfo("++ Object: %p, Size: %lu", 
+					Object, 
+					Object->Size);
+			}
+			
+			Cursor += sizeof(GCObject) + Object->Size;
+		}
+	}
 	
-#define CheckRegister(Register)					  \
-	if (IsGCBuffer(Register)) {					  \
-		GCObject *Object = GCGetObject(Stack);	  \
-		GCMarkObject(Object);					  \
+	for (size_t i = 0; !Free && i < LargeObjectCount; ++i) {
+		GCInfo("++ Large object: %p, Size: %lu",
+			LargeObjects[i],
+			LargeObjects[i]->Size);
 	}
 	
-	CheckRegister(r12);
-	CheckRegister(r13);
-	CheckRegister(r14);
-	CheckRegister(r15);
-	CheckRegister(rdi);
-	CheckRegister(rsi);
-	CheckRegister(rbx);
-	CheckRegister(rbp);
+	GCUnlockThreads();
+}
+
+void GCListUsedObjects()
+{
+	GCInitialize();
+	pthread_mutex_lock(&HeapLock);
+	
+	GCRetireBuffer(GCCurrentThread());
 	
-	GCSweep();
-	GCCompactBlocks(FreeBlocks);
-}
\ No newline at end of file
+	GCInfo("Used Objects");
+	GCReportBlocks(false);
+	
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCListFreeObjects()
+{
+	GCInitialize();
+	pthread_mutex_lock(&HeapLock);
+	
+	GCInfo("Free Objects");
+	GCReportBlocks(true);
+	
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCInitialize()
+{
+	pthread_once(&InitializeOnce, GCInitializeOnce);
+}
+	
+void GCInitializeOnce()
+{
+	MarkStack = GCCreateList();
+	
+	CollectionPercent = GCGetConfigInteger("GC_PERCENT", 100);
+	InitialHeapSize   = GCGetConfigSize("GC_INITIAL_HEAP", 1024 * 1024);
+	MaximumHeapSize   = GCGetConfigSize("GC_MAX_HEAP", 0);
+	MinimumTrigger    = GCGetConfigSize("GC_MIN_TRIGGER", 256 * 1024);
+		
+	CollectionTrigger = MinimumTrigger;
+	
+	StatsInterval = GCGetConfigInteger("GC_STATS_EVERY", 0);
+	CompactionInterval = GCGetConfigInteger("GC_COMPACT", 0);
+	
+	LargeObjectSize = GCGetConfigSize("GC_LARGE_OBJECT", DefaultLargeObjectSize);
+	if (LargeObjectSize <= MaximumBufferedSize) {
+		LargeObjectSize = MaximumBufferedSize + 1;
+	}
+	
+	BackgroundZeroing  = GCGetConfigInteger("GC_ZERO",
+		sysconf(_SC_NPROCESSORS_ONLN) > 1) > 0;
+	
+	size_t EventCount = GCGetConfigSize("GC_EVENT_LOG", 0);
+	if (EventCount) {
+		GCEnableEvents(EventCount);
+	}
+		
+	bool Added = GCAddSegment(InitialHeapSize);
+	assert(Added);
+}
+		
+/*
+ * Maps a new segment of at least Size bytes and adds it to
+ * the free list as a single block. Fails when the segment
+ * would grow the heap past GC_MAX_HEAP.
+ * The caller must hold the heap lock.
+ */
+bool GCAddSegment(size_t Size)
+{
+	size_t PageSize = sysconf(_SC_PAGESIZE);
+	Size += sizeof(GCObject) + MinimumAllocationSize;
+	
+	/*
+	 * One start bit per granule, in whole words, with room
+	 * for what rounding up to a page adds to the block area.
+	 */
+	size_t BitmapWords = ((Size + PageSize) / Granule + 63) / 64;
+	Size += sizeof(GCSegment) + BitmapWords * sizeof(uint64_t);
+	Size = (Size + PageSize - 1) & ~(PageSize - 1);
+	
+	if (MaximumHeapSize != 0 && HeapSize + Size > MaximumHeapSize) {
+		GCDebug("Growing by %lu bytes would exceed the maximum heap size",
+			Size);
+		return false;
+	}
+	
+	GCSegment *Segment = mmap(NULL, Size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (Segment == MAP_FAILED) {
+		GCError("Unable to map a segment of %lu bytes.", Size);
+		return false;
+	}
+	
+	Segment->Base = (char*)&Segment->Starts[BitmapWords];
+	Segment->End  = (char*)Segment + Size;
+	Segment->Size = Size;
+	Segment->LiveBytes = 0;
+	Segment->Evacuating = false;
+	Segment->Next = Segments;
+	Segments = Segment;
+	
+	HeapSize += Size;
+	GCEvent(GCEventGrowHeap, Segment, Size);
+	
+	GCObject *Block = (GCObject*)Segment->Base;
+	Block->Size = Segment->End - Segment->Base - sizeof(GCObject);
+	Block->Flags = GCFlagClean;
+	GCSetStart(Segment, Block, true);
+	GCPushFree(Segment, Block);
+	
+	GCTrace("Added segment %p with %lu bytes, heap size is %lu",
+		Segment, Size, HeapSize);
+	
+	return true;
+}
+
+/*
+ * Grows the heap so that a block of Needed bytes fits. The
+ * heap grows by at least half its size so that repeated
+ * small requests do not map many small segments.
+ */
+bool GCGrowHeap(size_t Needed)
+{
+	size_t Size = HeapSize / 2;
+	if (Size < Needed) {
+		Size = Needed;
+	}
+	
+	if (GCAddSegment(Size)) {
+		return true;
+	}
+	
+	return Size != Needed && GCAddSegment(Needed);
+}
+
+GCSegment *GCFindSegment(void *Address)
+{
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		if (Segment->Base <= (char*)Address && (char*)Address < Segment->End) {
+			return Segment;
+		}
+	}
+	
+	return NULL;
+}
+
+/*
+ * Sets the amount to allocate before the next collection
+ * from the bytes that survived this one, and grows the
+ * heap when the free space left cannot hold that much.
+ */
+void GCUpdateTrigger()
+{
+	CollectionTrigger = LiveBytes / 100 * CollectionPercent;
+	if (CollectionTrigger < MinimumTrigger) {
+		CollectionTrigger = MinimumTrigger;
+	}
+	
+	size_t FreeBytes = HeapSize - LiveBytes;
+	
+	GCDebug("Live bytes %lu, free bytes %lu, next collection after %lu bytes",
+		LiveBytes, FreeBytes, CollectionTrigger);
+	
+	if (CollectionPercent >= 0 && FreeBytes < CollectionTrigger) {
+		GCGrowHeap(CollectionTrigger - FreeBytes);
+	}
+}
+
+void GCMarkObject(GCObject *Object)
+{
+	assert(Object);
+	
+	if (Object->Flags & GCFlagMarked) {
+		return;
+	}
+	
+	GCDebug("Marking object %p", Object);
+	
+	/*
+	 * A pin left over from an earlier collection is
+	 * dropped; this one's ambiguous references set it
+	 * again.
+	 */
+	Object->Flags = (Object->Flags & ~GCFlagPinned) | GCFlagMarked;
+	
+	if (Object->Flags & GCFlagPointerFree) {
+		return;
+	}
+	
+	GCPushList(MarkStack, Object);
+	
+	size_t Depth = GCQueryListSize(MarkStack);
+	if (Depth > Stats.MarkStackHighWater) {
+		Stats.MarkStackHighWater = Depth;
+	}
+}
+	
+/*
+ * Marks what Pointer refers to, if it is an object at all.
+ * The word might be an integer that happens to look like a
+ * pointer, so the object is pinned: it cannot be moved
+ * without changing that word.
+ */
+void GCMarkAmbiguous(void *Pointer)
+{
+	if (IsGCBuffer(Pointer)) {
+		GCObject *Object = GCGetObject(Pointer);
+		GCMarkObject(Object);
+		Object->Flags |= GCFlagPinned;
+	}
+}
+
+/*
+ * Marks what a pointer word of a typed object refers to.
+ * The word is known to be a pointer, so it can be updated
+ * if the object moves.
+ */
+void GCMarkPrecise(void *Pointer)
+{
+	if (IsGCBuffer(Pointer)) {
+		GCMarkObject(GCGetObject(Pointer));
+	}
+}
+
+void GCScanRange(void **Begin, void **End)
+{
+	for (void **Word = Begin; Word < End; ++Word) {
+		GCMarkAmbiguous(*Word);
+	}
+}
+
+/*
+ * Pins the objects that words in a range refer to, without
+ * marking them.
+ */
+void GCPinRange(void **Begin, void **End)
+{
+	for (void **Word = Begin; Word < End; ++Word) {
+		if (IsGCBuffer(*Word)) {
+			GCGetObject(*Word)->Flags |= GCFlagPinned;
+		}
+	}
+}
+
+void GCScanObject(GCObject *Object)
+{
+	void **Buffer = GCGetBuffer(Object);
+	size_t Words = Object->Size / sizeof(void*);
+	const GCLayout *Layout = Object->Layout;
+	
+	if (Layout == NULL) {
+		GCScanRange(Buffer, Buffer + Words);
+		return;
+	}
+			
+	if (Layout->PointerCount == 0) {
+		return;
+	}
+			
+	/*
+	 * Visit only the words set in the layout's bitmap,
+	 * repeating the layout for arrays.
+	 */
+	size_t BitmapWords = (Layout->Words + BitsPerWord - 1) / BitsPerWord;
+	
+	for (size_t Base = 0; Base < Words; Base += Layout->Words) {
+		for (size_t i = 0; i < BitmapWords; ++i) {
+			uintptr_t Bits = Layout->Bitmap[i];
+			
+			while (Bits) {
+				size_t Word = Base + i * BitsPerWord +
+					__builtin_ctzl(Bits);
+				Bits &= Bits - 1;
+				
+				if (Word >= Words) {
+					break;
+				}
+				
+				GCMarkPrecise(Buffer[Word]);
+			}
+		}
+	}
+}
+
+void GCDrainMarkStack()
+{
+	size_t Size;
+	while ((Size = GCQueryListSize(MarkStack)) > 0) {
+		GCScanObject(GCPopList(MarkStack, Size - 1));
+	}
+}
+
+void GCPushRoot(void *Base, size_t Size, bool Precise)
+{
+	assert(Base);
+	
+	if (RootCount == RootCapacity) {
+		size_t Capacity = RootCapacity ? RootCapacity * 2 : 16;
+		GCRoot *Buffer = realloc(Roots, sizeof(GCRoot) * Capacity);
+		assert(Buffer);
+		Roots = Buffer;
+		RootCapacity = Capacity;
+	}
+	
+	Roots[RootCount].Base = Base;
+	Roots[RootCount].Size = Size;
+	Roots[RootCount].Precise = Precise;
+	++RootCount;
+}
+
+void GCAddRoot(void **Root)
+{
+	pthread_mutex_lock(&HeapLock);
+	GCPushRoot(Root, sizeof(void*), true);
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCAddRootRange(void *Base, size_t Size)
+{
+	pthread_mutex_lock(&HeapLock);
+	GCPushRoot(Base, Size, false);
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCRemoveRoot(void *Base)
+{
+	pthread_mutex_lock(&HeapLock);
+	
+	bool Found = false;
+	for (size_t i = 0; i < RootCount && !Found; ++i) {
+		if (Roots[i].Base == Base) {
+			Roots[i] = Roots[RootCount - 1];
+			--RootCount;
+			Found = true;
+		}
+	}
+	
+	pthread_mutex_unlock(&HeapLock);
+	
+	if (!Found) {
+		GCError("%p is not a registered root.", Base);
+	}
+}
+
+void GCSetStackScanning(bool Enabled)
+{
+	ScanStack = Enabled;
+}
+
+void GCRegisterFinalizer(
+	GCObject           *Object,
+	GCFinalizerFunction Function,
+	void               *Context)
+{
+	assert(Object && Function);
+	
+	GCInitialize();
+	pthread_once(&FinalizerThreadOnce, GCStartFinalizerThread);
+	
+	GCFinalizer *Finalizer = malloc(sizeof(GCFinalizer));
+	assert(Finalizer);
+	
+	Finalizer->Object = Object;
+	Finalizer->Function = Function;
+	Finalizer->Context = Context;
+	
+	pthread_mutex_lock(&HeapLock);
+	Finalizer->Next = Finalizers;
+	Finalizers = Finalizer;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+GCWeak *GCCreateWeak(void *Buffer)
+{
+	GCInitialize();
+	
+	GCWeak *Weak = malloc(sizeof(GCWeak));
+	assert(Weak);
+	
+	Weak->Target = Buffer;
+	Weak->Previous = NULL;
+	
+	pthread_mutex_lock(&HeapLock);
+	Weak->Next = WeakReferences;
+	if (WeakReferences) {
+		WeakReferences->Previous = Weak;
+	}
+	WeakReferences = Weak;
+	pthread_mutex_unlock(&HeapLock);
+	
+	return Weak;
+}
+
+/*
+ * No lock is needed: the target is only cleared while the
+ * world is stopped, and a target loaded before that is in
+ * this thread's registers or stack, so it is not cleared.
+ */
+void *GCGetWeak(GCWeak *Weak)
+{
+	return __atomic_load_n(&Weak->Target, __ATOMIC_RELAXED);
+}
+
+void GCDestroyWeak(GCWeak *Weak)
+{
+	pthread_mutex_lock(&HeapLock);
+	
+	if (Weak->Previous) {
+		Weak->Previous->Next = Weak->Next;
+	}
+	else {
+		WeakReferences = Weak->Next;
+	}
+	
+	if (Weak->Next) {
+		Weak->Next->Previous = Weak->Previous;
+	}
+	
+	pthread_mutex_unlock(&HeapLock);
+	
+	free(Weak);
+}
+
+void GCStartFinalizerThread()
+{
+	pthread_t Thread;
+	int Result = pthread_create(&Thread, NULL, GCRunFinalizers, NULL);
+	assert(Result == 0);
+	pthread_detach(Thread);
+}
+
+/*
+ * The finalizer thread. Finalizers run here, after the
+ * collection that queued them has restarted the world,
+ * so they may allocate and take locks freely.
+ */
+void *GCRunFinalizers(void *Argument)
+{
+	/*
+	 * Finalizers hold pointers to objects on this stack,
+	 * which compaction must see.
+	 */
+	GCRegisterThread();
+	
+	pthread_mutex_lock(&HeapLock);
+	
+	for (;;) {
+		while (!PendingFinalizers) {
+			pthread_cond_wait(&FinalizersReady, &HeapLock);
+		}
+		
+		RunningFinalizers = PendingFinalizers;
+		PendingFinalizers = NULL;
+		pthread_mutex_unlock(&HeapLock);
+		
+		size_t Count = 0;
+		for (GCFinalizer *Finalizer = RunningFinalizers; Finalizer; Finalizer = Finalizer->Next) {
+			Finalizer->Function(GCGetBuffer(Finalizer->Object), Finalizer->Context);
+			++Count;
+		}
+		
+		GCDebug("Ran %lu finalizers", Count);
+		
+		pthread_mutex_lock(&HeapLock);
+		GCFinalizer *Batch = RunningFinalizers;
+		RunningFinalizers = NULL;
+		Stats.Finalized += Count;
+		pthread_mutex_unlock(&HeapLock);
+		
+		while (Batch) {
+			GCFinalizer *Next = Batch->Next;
+			free(Batch);
+			Batch = Next;
+		}
+		
+		pthread_mutex_lock(&HeapLock);
+	}
+	
+	return NULL;
+}
+
+void GCStartZeroingThread()
+{
+	pthread_t Thread;
+	int Result = pthread_create(&Thread, NULL, GCRunZeroing, NULL);
+	assert(Result == 0);
+	pthread_detach(Thread);
+}
+
+/*
+ * The zeroing thread. It zeroes one dirty block at a time
+ * without the heap lock, so allocation and collection go
+ * on meanwhile, and hands it back clean. The block is not
+ * an object, so the thread does not need to be registered.
+ */
+void *GCRunZeroing(void *Argument)
+{
+	pthread_mutex_lock(&HeapLock);
+	
+	for (;;) {
+		GCObject *Block = GCTakeDirtyBlock();
+		
+		if (!Block) {
+			pthread_cond_wait(&ZeroingReady, &HeapLock);
+			continue;
+		}
+		
+		pthread_mutex_unlock(&HeapLock);
+		GCZero(GCGetBuffer(Block), Block->Size);
+		pthread_mutex_lock(&HeapLock);
+		
+		Block->Flags = (Block->Flags & GCFlagPreviousFree) | GCFlagClean;
+		GCFreeBlock(GCFindSegment(Block), Block);
+		++Stats.ZeroedBlocks;
+	}
+	
+	return NULL;
+}
+
+/*
+ * Takes a dirty free block of at least ZeroingMinimumSize
+ * bytes off the free lists and marks it as being zeroed,
+ * or returns NULL if there is none.
+ * The caller must hold the heap lock.
+ */
+GCObject *GCTakeDirtyBlock()
+{
+	for (size_t Bin = GCBinIndex(ZeroingMinimumSize); Bin < FreeBinCount; ++Bin) {
+		for (GCObject *Block = FreeBins[Bin]; Block; Block = GCLinks(Block)->Next) {
+			if ((Block->Flags & GCFlagClean) || Block->Size < ZeroingMinimumSize) {
+				continue;
+			}
+			
+			GCUnlinkFree(Block);
+			Block->Flags |= GCFlagZeroing;
+			
+			GCObject *Next = GCNextBlock(GCFindSegment(Block), Block);
+			if (Next) {
+				Next->Flags &= ~GCFlagPreviousFree;
+			}
+			
+			return Block;
+		}
+	}
+	
+	return NULL;
+}
+
+/*
+ * Zeroes Size bytes, a multiple of the granule, with
+ * non-temporal stores where available, so that zeroing in
+ * the background does not evict the mutators' data from
+ * the caches.
+ */
+void GCZero(void *Buffer, size_t Size)
+{
+#if defined(__SSE2__)
+	char *Cursor = Buffer;
+	char *End = Cursor + Size;
+	
+	if ((uintptr_t)Cursor % 16 != 0 && Cursor < End) {
+		*(uint64_t*)Cursor = 0;
+		Cursor += 8;
+	}
+	
+	__m128i Zero = _mm_setzero_si128();
+	
+	for (; Cursor + 64 <= End; Cursor += 64) {
+		_mm_stream_si128((__m128i*)Cursor, Zero);
+		_mm_stream_si128((__m128i*)(Cursor + 16), Zero);
+		_mm_stream_si128((__m128i*)(Cursor + 32), Zero);
+		_mm_stream_si128((__m128i*)(Cursor + 48), Zero);
+	}
+	
+	_mm_sfence();
+	memset(Cursor, 0, End - Cursor);
+#else
+	memset(Buffer, 0, Size);
+#endif
+}
+
+void GCScanRoots()
+{
+	for (size_t i = 0; i < RootCount; ++i) {
+		GCRoot *Root = &Roots[i];
+		
+		if (Root->Precise) {
+			void *Pointer = *(void**)Root->Base;
+			
+			if (Pointer != NULL) {
+				assert(IsGCBuffer(Pointer));
+				GCMarkObject(GCGetObject(Pointer));
+			}
+		}
+		else {
+			void **Begin = Root->Base;
+			GCScanRange(Begin, Begin + Root->Size / sizeof(void*));
+		}
+	}
+}
+
+/*
+ * Walks every segment, freeing unmarked objects and
+ * rebuilding the free lists as it goes. Each run of
+ * adjacent dead and free blocks becomes a single free
+ * block, so no separate coalescing pass is needed.
+ */
+void GCSweep()
+{
+	/*
+	 * Weak references are cleared before finalizable
+	 * objects are kept alive, so a finalized object is
+	 * never reachable through a weak reference again.
+	 */
+	GCClearWeakReferences();
+	GCQueueFinalizers();
+	
+	memset(FreeBins, 0, sizeof(FreeBins));
+	NonEmptyBins = 0;
+	LiveBytes = 0;
+	
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		LiveBytes += GCSweepSegment(Segment);
+	}
+	
+	GCSweepLargeObjects();
+}
+
+/*
+ * Removes the unmarked large objects from the index, keeping
+ * it sorted, and caches or unmaps them. Cached mappings that
+ * were not reused since the last sweep are unmapped.
+ */
+void GCSweepLargeObjects()
+{
+	size_t Kept = 0;
+	
+	for (size_t i = 0; i < LargeCacheCount; ++i) {
+		size_t Mapped = sizeof(GCObject) + LargeCache[i]->Size;
+		HeapSize -= Mapped;
+		munmap(LargeCache[i], Mapped);
+	}
+	
+	LargeCacheCount = 0;
+	
+	for (size_t i = 0; i < LargeObjectCount; ++i) {
+		GCObject *Object = LargeObjects[i];
+		size_t Mapped = sizeof(GCObject) + Object->Size;
+		
+		if (Object->Flags & GCFlagMarked) {
+			Object->Flags &= ~GCFlagMarked;
+			LiveBytes += Mapped;
+			LargeObjects[Kept++] = Object;
+			continue;
+		}
+		
+		GCTrace("Reclaiming large object %p with size %lu",
+			Object, Object->Size);
+		
+		Stats.ReclaimedBytes += Mapped;
+		++Stats.ReclaimedObjects;
+		
+		if (LargeCacheCount < LargeCacheSize) {
+			LargeCache[LargeCacheCount++] = Object;
+		}
+		else {
+			HeapSize -= Mapped;
+			munmap(Object, Mapped);
+		}
+	}
+	
+	LargeObjectCount = Kept;
+}
+
+/*
+ * Sweeps one segment, returning the bytes that stay live.
+ * The free lists must not hold any of its free blocks. A
+ * block being zeroed is left alone, like a live one.
+ */
+size_t GCSweepSegment(GCSegment *Segment)
+{
+	GCObject *Run = NULL;
+	char *Cursor = Segment->Base;
+	size_t Live = 0;
+	
+	while (Cursor < Segment->End) {
+		GCObject *Object = (GCObject*)Cursor;
+		Cursor += sizeof(GCObject) + Object->Size;
+		
+		if (Object->Flags & GCFlagMarked) {
+			Object->Flags &= ~(GCFlagMarked | GCFlagPreviousFree);
+			Live += sizeof(GCObject) + Object->Size;
+			
+			if (Run) {
+				GCPushFree(Segment, Run);
+				Run = NULL;
+			}
+			continue;
+		}
+		
+		if (Object->Flags & GCFlagZeroing) {
+			if (Run) {
+				GCPushFree(Segment, Run);
+				Run = NULL;
+			}
+			continue;
+		}
+		
+		if (!(Object->Flags & GCFlagFree)) {
+			GCTrace("Freeing object %p with size %lu", 
+				Object, Object->Size);
+			
+			Stats.ReclaimedBytes += sizeof(GCObject) + Object->Size;
+			++Stats.ReclaimedObjects;
+		}
+		
+		if (Run) {
+			GCAbsorb(Run, Object);
+			GCSetStart(Segment, Object, false);
+		}
+		else {
+			Run = Object;
+		}
+	}
+	
+	if (Run) {
+		GCPushFree(Segment, Run);
+	}
+	
+	Segment->LiveBytes = Live;
+	return Live;
+}
+
+/*
+ * Mostly-copying compaction, after Bartlett. It runs right
+ * after the sweep, so every block that is not free is live.
+ *
+ * The sparsest segments are evacuated, as many as the free
+ * space in the other segments can take. Their live objects
+ * are copied in address order into the evacuator's
+ * allocation buffer, which is refilled from the other
+ * segments' free blocks, or from a fresh segment once those
+ * run out, and every precise reference to them is updated. A page holding a pinned object stays in
+ * place, and so does everything left once the free space
+ * runs out. The evacuated segments are then swept again,
+ * which merges the space that was moved out of into large
+ * free blocks.
+ */
+void GCCompact()
+{
+	/*
+	 * Without stack scanning nothing was marked from the
+	 * stacks, but what they point to must not move either.
+	 */
+	if (!ScanStack) {
+		for (GCThread *Thread = GCFirstThread(); Thread; Thread = Thread->Next) {
+			GCScanStack(Thread, GCPinRange);
+		}
+	}
+	
+	size_t Room = 0;
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		Room += Segment->End - Segment->Base - Segment->LiveBytes;
+	}
+	
+	size_t Moving = 0;
+	bool Evacuating = false;
+	
+	for (;;) {
+		GCSegment *Sparsest = NULL;
+		double SparsestOccupancy = 1.0 / CompactionOccupancy;
+		
+		for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+			double Occupancy = (double)Segment->LiveBytes /
+				(Segment->End - Segment->Base);
+			
+			if (!Segment->Evacuating && Segment->LiveBytes > 0 &&
+				Occupancy < SparsestOccupancy)
+			{
+				Sparsest = Segment;
+				SparsestOccupancy = Occupancy;
+			}
+		}
+		
+		if (!Sparsest) {
+			break;
+		}
+		
+		/*
+		 * The sparsest segment is always evacuated, into
+		 * fresh pages if need be; the others only when the
+		 * free space left can take them.
+		 */
+		size_t Free = Sparsest->End - Sparsest->Base - Sparsest->LiveBytes;
+		if (Evacuating && Moving + Sparsest->LiveBytes + Free > Room) {
+			break;
+		}
+		
+		Sparsest->Evacuating = true;
+		Moving += Sparsest->LiveBytes;
+		Room -= Free;
+		Evacuating = true;
+	}
+	
+	if (!Evacuating) {
+		return;
+	}
+	
+	GCDebug("Evacuating %lu bytes", Moving);
+	
+	/*
+	 * Take the evacuated segments' free blocks off the
+	 * free lists so the evacuator does not copy into them.
+	 */
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		if (!Segment->Evacuating) {
+			continue;
+		}
+		
+		for (char *Cursor = Segment->Base; Cursor < Segment->End; ) {
+			GCObject *Object = (GCObject*)Cursor;
+			Cursor += sizeof(GCObject) + Object->Size;
+			
+			if ((Object->Flags & GCFlagFree) && !(Object->Flags & GCFlagZeroing)) {
+				GCUnlinkFree(Object);
+			}
+		}
+	}
+	
+	/*
+	 * Objects that stay are marked again so that sweeping
+	 * the segment once more keeps them.
+	 */
+	size_t Moved = Stats.MovedObjects;
+	size_t MovedBytes = Stats.MovedBytes;
+	bool Full = false;
+	
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		if (!Segment->Evacuating) {
+			continue;
+		}
+		
+		char *Cursor = Segment->Base;
+		
+		while (Cursor < Segment->End) {
+			size_t Offset = Cursor - Segment->Base;
+			char *PageEnd = Segment->Base +
+				(Offset / CompactionPageSize + 1) * CompactionPageSize;
+			
+			char *Page = Cursor;
+			bool Pinned = Full;
+			
+			while (Cursor < PageEnd && Cursor < Segment->End) {
+				GCObject *Object = (GCObject*)Cursor;
+				Cursor += sizeof(GCObject) + Object->Size;
+				
+				if (!(Object->Flags & GCFlagFree) &&
+					((Object->Flags & GCFlagPinned) || Object->Size > MaximumBufferedSize))
+				{
+					Pinned = true;
+				}
+			}
+			
+			for (char *Next = Page; Next < Cursor; ) {
+				GCObject *Object = (GCObject*)Next;
+				Next += sizeof(GCObject) + Object->Size;
+				
+				if (Object->Flags & GCFlagFree) {
+					continue;
+				}
+				
+				if (!Pinned && !Full && !GCEvacuate(Object)) {
+					size_t Left = Moving - (Stats.MovedBytes - MovedBytes);
+					
+					if (!GCAddSegment(Left) || !GCEvacuate(Object)) {
+						GCDebug("No room left to evacuate %p", Object);
+						Full = true;
+					}
+				}
+				
+				if (!(Object->Flags & GCFlagForwarded)) {
+					Object->Flags |= GCFlagMarked;
+				}
+			}
+		}
+	}
+	
+	GCRetireBuffer(&Evacuator);
+	if (Stats.MovedObjects != Moved) {
+		GCUpdateReferences();
+	}
+	
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		if (Segment->Evacuating) {
+			GCSweepSegment(Segment);
+			Segment->Evacuating = false;
+		}
+	}
+}
+
+/*
+ * Copies Object into the evacuator's allocation buffer and
+ * leaves its new address behind. Fails when no free block
+ * outside the evacuated segments can hold it.
+ */
+bool GCEvacuate(GCObject *Object)
+{
+	GCObject *Copy = GCAllocBuffered(&Evacuator, Object->Size);
+	
+	if (!Copy) {
+		if (!GCRefillBuffer(&Evacuator, Object->Size)) {
+			return false;
+		}
+		
+		Copy = GCAllocBuffered(&Evacuator, Object->Size);
+		assert(Copy);
+	}
+	
+	/*
+	 * The copy may have absorbed the end of the buffer,
+	 * which must not look like pointers.
+	 */
+	void *Buffer = GCGetBuffer(Copy);
+	memcpy(Buffer, GCGetBuffer(Object), Object->Size);
+	memset((char*)Buffer + Object->Size, 0, Copy->Size - Object->Size);
+	Copy->Layout = Object->Layout;
+	Copy->Flags = Object->Flags & GCFlagPointerFree;
+	
+	GCTrace("Moving object %p to %p", Object, Copy);
+	
+	Stats.MovedBytes += sizeof(GCObject) + Object->Size;
+	++Stats.MovedObjects;
+	
+	Object->Flags = GCFlagFree | GCFlagForwarded;
+	*(GCObject**)GCGetBuffer(Object) = Copy;
+	
+	return true;
+}
+
+/*
+ * Points Slot at the new copy of the object it refers to,
+ * if that object has moved.
+ */
+void GCForward(void **Slot)
+{
+	GCSegment *Segment = GCFindSegment(*Slot);
+	if (!Segment || !Segment->Evacuating) {
+		return;
+	}
+	
+	GCObject *Object = GCGetObject(*Slot);
+	if ((char*)Object < Segment->Base || (uintptr_t)Object % Granule != 0 ||
+		!GCIsStart(Segment, Object))
+	{
+		return;
+	}
+	
+	if (Object->Flags & GCFlagForwarded) {
+		*Slot = GCGetBuffer(*(GCObject**)*Slot);
+	}
+}
+
+void GCForwardObject(GCObject *Object)
+{
+	void **Buffer = GCGetBuffer(Object);
+	size_t Words = Object->Size / sizeof(void*);
+	const GCLayout *Layout = Object->Layout;
+	
+	if (Layout == NULL || Layout->PointerCount == 0) {
+		return;
+	}
+	
+	size_t BitmapWords = (Layout->Words + BitsPerWord - 1) / BitsPerWord;
+	
+	for (size_t Base = 0; Base < Words; Base += Layout->Words) {
+		for (size_t i = 0; i < BitmapWords; ++i) {
+			uintptr_t Bits = Layout->Bitmap[i];
+			
+			while (Bits) {
+				size_t Word = Base + i * BitsPerWord +
+					__builtin_ctzl(Bits);
+				Bits &= Bits - 1;
+				
+				if (Word >= Words) {
+					break;
+				}
+				
+				GCForward(&Buffer[Word]);
+			}
+		}
+	}
+}
+
+/*
+ * Updates the precise references to moved objects: the
+ * pointer words of typed objects, precise roots,
+ * finalizers and weak references. Ambiguous references
+ * pin what they refer to, so they never need updating.
+ */
+void GCUpdateReferences()
+{
+	for (GCSegment *Segment = Segments; Segment; Segment = Segment->Next) {
+		for (char *Cursor = Segment->Base; Cursor < Segment->End; ) {
+			GCObject *Object = (GCObject*)Cursor;
+			Cursor += sizeof(GCObject) + Object->Size;
+			
+			if (!(Object->Flags & GCFlagFree)) {
+				GCForwardObject(Object);
+			}
+		}
+	}
+		
+	for (size_t i = 0; i < LargeObjectCount; ++i) {
+		GCForwardObject(LargeObjects[i]);
+	}
+	
+	for (size_t i = 0; i < RootCount; ++i) {
+		if (Roots[i].Precise) {
+			GCForward(Roots[i].Base);
+		}
+	}
+	
+	GCFinalizer *Lists[] = { Finalizers, PendingFinalizers };
+	for (size_t i = 0; i < 2; ++i) {
+		for (GCFinalizer *Finalizer = Lists[i]; Finalizer; Finalizer = Finalizer->Next) {
+			void *Buffer = GCGetBuffer(Finalizer->Object);
+			GCForward(&Buffer);
+			Finalizer->Object = GCGetObject(Buffer);
+		}
+	}
+	
+	for (GCWeak *Weak = WeakReferences; Weak; Weak = Weak->Next) {
+		void *Target = Weak->Target;
+		if (Target) {
+			GCForward(&Target);
+			__atomic_store_n(&Weak->Target, Target, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void GCClearWeakReferences()
+{
+	for (GCWeak *Weak = WeakReferences; Weak; Weak = Weak->Next) {
+		if (Weak->Target && !(GCGetObject(Weak->Target)->Flags & GCFlagMarked)) {
+			GCTrace("Clearing weak reference to %p", Weak->Target);
+			__atomic_store_n(&Weak->Target, NULL, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/*
+ * Moves the finalizers of unreachable objects to the
+ * pending list, and marks those objects and everything
+ * they reference so the finalizers can still use them.
+ */
+void GCQueueFinalizers()
+{
+	GCFinalizer **Link = &Finalizers;
+	bool Queued = false;
+	
+	while (*Link) {
+		GCFinalizer *Finalizer = *Link;
+		
+		if (Finalizer->Object->Flags & GCFlagMarked) {
+			Link = &Finalizer->Next;
+			continue;
+		}
+		
+		*Link = Finalizer->Next;
+		Finalizer->Next = PendingFinalizers;
+		PendingFinalizers = Finalizer;
+		
+		GCMarkObject(Finalizer->Object);
+		Queued = true;
+	}
+	
+	if (Queued) {
+		GCDrainMarkStack();
+	}
+}
+
+/*
+ * Queued objects are pinned: the finalizer thread reads
+ * the running batch without the heap lock.
+ */
+void GCMarkFinalizers(GCFinalizer *List)
+{
+	for (GCFinalizer *Finalizer = List; Finalizer; Finalizer = Finalizer->Next) {
+		GCMarkObject(Finalizer->Object);
+		Finalizer->Object->Flags |= GCFlagPinned;
+	}
+}
+
+bool IsGCBuffer(void *Buffer)
+{
+	GCSegment *Segment = GCFindSegment(Buffer);
+	if (!Segment) {
+		return GCFindLargeObject(Buffer) != NULL;
+	}
+	
+	GCObject *Object = GCGetObject(Buffer);
+	if ((char*)Object < Segment->Base || (uintptr_t)Object % Granule != 0) {
+		return false;
+	}
+	
+	return GCIsStart(Segment, Object) && !(Object->Flags & GCFlagFree);
+}
+
+/*
+ * Scans the calling thread's stack, from this function's
+ * frame up to the base cached in its GCThread. The caller
+ * has already spilled the callee-saved registers into its
+ * own frame, which lies inside the scanned range.
+ */
+static __attribute__((noinline)) void GCScanStackFrom(
+	GCThread *Thread,
+	void    (*Visit)(void **Begin, void **End))
+{
+	void **Stack = __builtin_frame_address(0);
+
+	GCDebug("Scanning from %p to the stack base %p",
+		Stack,
+		Thread->StackBase);
+	
+	Visit(Stack, Thread->StackBase);
+}
+
+/*
+ * Passes the thread's stack to Visit, which is GCScanRange
+ * to mark what it references or GCPinRange to pin it.
+ */
+static void GCScanStack(GCThread *Thread, void (*Visit)(void **Begin, void **End))
+{
+	if (Thread != GCCurrentThread()) {
+		/*
+		 * The thread spilled its registers before it
+		 * recorded StackPointer in GCSuspendSelf().
+		 */
+		GCDebug("Scanning suspended thread from %p to %p",
+			Thread->StackPointer,
+			Thread->StackBase);
+		
+		Visit(Thread->StackPointer, Thread->StackBase);
+		return;
+	}
+			
+	/*
+	 * Registers may hold the only reference to an object.
+	 * __builtin_unwind_init() forces every callee-saved
+	 * register onto this frame; setjmp() is a fallback for
+	 * compilers that do not spill them.
+	 */
+	jmp_buf Registers;
+	__builtin_unwind_init();
+	setjmp(Registers);
+	
+	GCScanStackFrom(Thread, Visit);
+}
+	
+void GCCollect()
+{
+	GCInitialize();
+	GCCurrentThread();
+	
+	pthread_mutex_lock(&HeapLock);
+	GCCollectLocked();
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void GCCollectLocked()
+{
+	GCEvent(GCEventCollectStart, AllocatedBytes, HeapSize);
+	
+	double Start = GCNow();
+	
+	GCLockThreads();
+	GCStopWorld();
+	
+	double Stopped = GCNow();
+	
+	for (GCThread *Thread = GCFirstThread(); Thread; Thread = Thread->Next) {
+		GCRetireBuffer(Thread);
+		
+		if (Thread->LastObject) {
+			GCMarkObject(Thread->LastObject);
+			Thread->LastObject->Flags |= GCFlagPinned;
+		}
+	}
+	
+	GCScanRoots();
+	GCMarkFinalizers(PendingFinalizers);
+	GCMarkFinalizers(RunningFinalizers);
+	
+	if (ScanStack) {
+		for (GCThread *Thread = GCFirstThread(); Thread; Thread = Thread->Next) {
+			GCScanStack(Thread, GCScanRange);
+		}
+	}
+	
+	double RootsScanned = GCNow();
+	GCDrainMarkStack();
+	double Marked = GCNow();
+	GCSweep();
+	double Swept = GCNow();
+	
+	if (CompactionInterval > 0 && (Stats.Collections + 1) % CompactionInterval == 0) {
+		GCCompact();
+	}
+	
+	double Compacted = GCNow();
+	
+	AllocatedBytes = 0;
+	
+	GCStartWorld();
+	GCUnlockThreads();
+	
+	double End = GCNow();
+	double Pause = End - Start;
+	
+	++Stats.Collections;
+	Stats.SuspendTime  += (Stopped - Start) + (End - Compacted);
+	Stats.RootScanTime += RootsScanned - Stopped;
+	Stats.MarkTime     += Marked - RootsScanned;
+	Stats.SweepTime    += Swept - Marked;
+	Stats.CompactTime  += Compacted - Swept;
+	Stats.LastPause     = Pause;
+	Stats.TotalPause   += Pause;
+	if (Pause > Stats.MaximumPause) {
+		Stats.MaximumPause = Pause;
+	}
+	
+	GCEvent(GCEventCollectEnd, LiveBytes, HeapSize);
+	
+	if (PendingFinalizers) {
+		pthread_cond_signal(&FinalizersReady);
+	}
+	
+	if (BackgroundZeroing) {
+		pthread_once(&ZeroingThreadOnce, GCStartZeroingThread);
+		pthread_cond_signal(&ZeroingReady);
+	}
+	
+	GCUpdateTrigger();
+	
+	if (StatsInterval > 0 && Stats.Collections % StatsInterval == 0) {
+		GCStats Current;
+		GCGetStatsLocked(&Current);
+		GCDumpStats(STDERR_FILENO, &Current);
+	}
+}
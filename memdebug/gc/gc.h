@@ -1,13 +1,93 @@
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef struct GCObject GCObject;
+typedef struct GCThread GCThread;
+typedef struct GCStats GCStats;
+typedef struct GCWeak GCWeak;
+
+/*
+ * A GCLayout describes which words of an object hold
+ * pointers. Objects allocated with a layout are scanned
+ * precisely: only the words marked in the layout are
+ * considered during marking. Objects larger than the
+ * layout repeat it, so a layout for a struct also
+ * describes an array of that struct.
+ *
+ * A layout without pointer offsets describes a pointer-free
+ * object, which is never scanned. A NULL layout requests
+ * conservative scanning of every word.
+ */
+typedef struct GCLayout GCLayout;
 
 void 	 *GCGetBuffer(GCObject *Object);
 GCObject *GCGetObject(void *Buffer);
 
+GCLayout *GCCreateLayout(
+	size_t        Size,
+	const size_t *PointerOffsets,
+	size_t        PointerCount);
+
 GCObject *GCAlloc(size_t Size);
+GCObject *GCAllocTyped(size_t Size, const GCLayout *Layout);
+
+/*
+ * Roots are scanned in addition to the stack. A precise
+ * root is a single slot holding either NULL or a pointer
+ * returned by the allocator. A root range is scanned
+ * conservatively, word by word.
+ */
+void      GCAddRoot(void **Root);
+void      GCAddRootRange(void *Base, size_t Size);
+void      GCRemoveRoot(void *Base);
+
+/*
+ * Conservative stack scanning is enabled by default.
+ * Programs that register all of their roots can turn it
+ * off to avoid scanning the stack and retaining objects
+ * through stale stack words.
+ */
+void      GCSetStackScanning(bool Enabled);
+
+/*
+ * A finalizer runs once its object has become unreachable.
+ * Finalizers run in batches on a dedicated thread after the
+ * collection that found them, never while the world is
+ * stopped. The object, and everything it references, stays
+ * allocated until its finalizer has returned, and is freed
+ * by a later collection unless the finalizer made it
+ * reachable again. Finalizers do not run at exit.
+ */
+typedef void (*GCFinalizerFunction)(void *Buffer, void *Context);
+
+void      GCRegisterFinalizer(
+	GCObject           *Object,
+	GCFinalizerFunction Function,
+	void               *Context);
+
+/*
+ * A weak reference refers to a buffer without keeping it
+ * alive. GCGetWeak() returns the buffer, or NULL once a
+ * collection has found it unreachable through anything but
+ * weak references. Weak references to an object with a
+ * finalizer are cleared before the finalizer runs.
+ */
+GCWeak   *GCCreateWeak(void *Buffer);
+void     *GCGetWeak(GCWeak *Weak);
+void      GCDestroyWeak(GCWeak *Weak);
+
+/*
+ * Hands a thread's allocation buffer back to the heap.
+ * Called when the thread is unregistered.
+ */
+void      GCReleaseThread(GCThread *Thread);
 
 void 	  GCListUsedObjects();
 void      GCListFreeObjects();
 
-void	  GCCollect();
\ No newline at end of file
+void	  GCCollect();
+
+/*
+ * Fills Stats with the collector's counters. See stats.h.
+ */
+void      GCGetStats(GCStats *Stats);
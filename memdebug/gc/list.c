@@ -1,20 +1,24 @@
+#define _GNU_SOURCE
 #include <assert.h>
-#include <stdbool.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include "list.h"
 
-#define GC_LIST_INITIAL_CAPACITY 10
+/*
+ * List buffers are mapped directly instead of being
+ * malloc'd. The collector grows lists while the other
+ * threads are suspended, and one of them may have been
+ * suspended inside malloc() holding its lock.
+ */
+#define GC_LIST_INITIAL_CAPACITY 512
 
 typedef struct GCList {
 	size_t Size;
 	size_t Capacity;
-	bool Pinned;
 	GCObject **Buffer;
 } GCList;
 
-static int ComparePointers(const void *a, const void *b);
-
 GCList *GCCreateList()
 {
 	GCList *List = malloc(sizeof(GCList));
@@ -22,10 +26,10 @@ GCList *GCCreateList()
 	
 	List->Size = 0;
 	List->Capacity = GC_LIST_INITIAL_CAPACITY;
-	List->Pinned = false;
-	List->Buffer = malloc(sizeof(GCObject*) * 
-		GC_LIST_INITIAL_CAPACITY);
-	assert(List->Buffer);
+	List->Buffer = mmap(NULL, sizeof(GCObject*) * 
+		GC_LIST_INITIAL_CAPACITY, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(List->Buffer != MAP_FAILED);
 	
 	return List;
 }
@@ -34,19 +38,20 @@ void GCDestroyList(GCList *List)
 {
 	assert(List);
 	
-	free(List->Buffer);
+	munmap(List->Buffer, sizeof(GCObject*) * List->Capacity);
 	free(List);
 }
 
 void GCPushList(GCList *List, GCObject *Object)
 {
 	assert(List);
-	assert(!List->Pinned);
 	
 	if (List->Size == List->Capacity) {
-		GCObject **Buffer = realloc(List->Buffer, 
-			sizeof(GCObject*) * List->Capacity * 2);
-		assert(Buffer);
+		GCObject **Buffer = mremap(List->Buffer, 
+			sizeof(GCObject*) * List->Capacity,
+			sizeof(GCObject*) * List->Capacity * 2,
+			MREMAP_MAYMOVE);
+		assert(Buffer != MAP_FAILED);
 		List->Buffer = Buffer;
 		List->Capacity *= 2;
 	}
@@ -61,14 +66,9 @@ GCObject *GCPopList(GCList *List, size_t Index)
 	assert(Index < List->Size);
 	
 	GCObject *Object = List->Buffer[Index];
-	if (List->Pinned) {
-		List->Buffer[Index] = NULL;
-	}
-	else {
-		List->Buffer[Index] = List->Buffer[List->Size - 1];
-		List->Buffer[List->Size - 1] = NULL;
-		--List->Size;
-	}
+	List->Buffer[Index] = List->Buffer[List->Size - 1];
+	List->Buffer[List->Size - 1] = NULL;
+	--List->Size;
 	
 	return Object;
 }
@@ -78,86 +78,4 @@ size_t GCQueryListSize(const GCList *List)
 	assert(List);
 	
 	return List->Size;
-}
-
-GCObject *GCGetListEntry(const GCList *List, size_t Index)
-{
-	assert(List);
-	assert(Index < List->Size);
-	
-	return List->Buffer[Index];
-}
-
-size_t GCIndexOfList(
-	const GCList *List, 
-	const GCObject *Object)
-{
-	assert(List);
-	assert(Object);
-	
-	for (size_t i = 0; i < List->Size; ++i) {
-		if (List->Buffer[i] == Object) {
-			return i;
-		}
-	}
-	
-	return GCNoSuchObject;
-}
-
-void GCPinList(GCList *List)
-{
-	assert(List);
-	assert(!List->Pinned);
-	
-	List->Pinned = true;
-}
-
-void GCUnpinList(GCList *List)
-{
-	assert(List);
-	assert(List->Pinned);
-	
-	List->Pinned = false;
-	
-	if (List->Size == 0) {
-		return;
-	}
-	
-	size_t WriteIndex = 0;
-	size_t ReadIndex  = List->Size - 1;
-	
-	for (; WriteIndex < ReadIndex; ++WriteIndex) {
-		if (List->Buffer[WriteIndex] == NULL) {
-			List->Buffer[WriteIndex] = List->Buffer[ReadIndex];
-			List->Buffer[ReadIndex] = NULL;
-			
-			for (; List->Buffer[ReadIndex] == NULL 
-				&& WriteIndex < ReadIndex; 
-				--ReadIndex)
-			{
-			}
-		}
-	}
-	
-	if (List->Buffer[0] == NULL) {
-		List->Size = 0;
-	}
-	else {
-		for (; List->Buffer[List->Size - 1] == NULL; --List->Size)
-		{
-		}
-	}
-}
-
-void GCSortList(GCList *List)
-{
-	qsort(List->Buffer, List->Size, 
-		sizeof(void*), ComparePointers);
-}
-
-static int ComparePointers(const void *a, const void *b)
-{
-	if (a < b) return -1;
-	if (b < a) return 1;
-	return 0;
 }
\ No newline at end of file
@@ -3,35 +3,23 @@
 /*
  * A GCList an unordered collection of pointers.
  * Elements are inserted with GCPushList() and
- * removed with GCPopList().
- *
- * To iterate through a GCList:
- *    size_t ListSize = GCQueryListSize(List);
- *    for (size_t i = 0; i < ListSize; ++i)
+ * removed with GCPopList(). The collector uses one
+ * as its mark stack, popping the last element:
+ *    size_t Size;
+ *    while ((Size = GCQueryListSize(List)) > 0)
  *    {
- *        GCObject *Object = GCGetListEntry(List, i);
- *       // Do something with the object
+ *        GCObject *Object = GCPopList(List, Size - 1);
+ *        // Do something with the object
  *    }
  *
- * Any call to GCPushList() or GCPopList() while
- * iterating through a GCList causes unspecified
- * behavior. There is no safe way to insert items
- * while iterating.
- * If items are to be removed while iterating, call
- * GCPinList() before starting the loop. GCPinList()
- * prevents the GCList's elements from moving, which
- * normally only happends when an item is removed.
- * Call GCUnpinList() after the loop.
- *
- * The order of a GCList may change when the list is
- * modified.
+ * GCPopList() moves the last element into the hole
+ * it leaves, so the order of a GCList may change when
+ * the list is modified.
  */
 
 typedef struct GCList GCList;
 typedef struct GCObject GCObject;
 
-#define GCNoSuchObject (size_t)-1
-
 GCList *GCCreateList();
 
 void GCDestroyList(
@@ -46,18 +34,4 @@ GCObject *GCPopList(
 	size_t  Index);
 
 size_t GCQueryListSize(
-	const GCList *List);
-GCObject *GCGetListEntry(
-	const GCList *List, 
-	size_t Index);
-size_t GCIndexOfList(
-	const GCList *List, 
-	const GCObject *Object);
-	
-void GCPinList(
-	GCList *List);
-void GCUnpinList(
-	GCList *List);
-
-void GCSortList(
-	GCList *List);
\ No newline at end of file
+	const GCList *List);
\ No newline at end of file
@@ -1,16 +1,43 @@
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "log.h"
 
+/*
+ * Messages are formatted on the stack and written with a
+ * single write() rather than through stdio. The collector
+ * logs while other threads are suspended, and one of them
+ * may be holding the stdio lock.
+ */
+static void GCWriteLog(int File, const char *Function, const char *Format, va_list Args)
+{
+	char Buffer[1024];
+	int Length = snprintf(Buffer, sizeof(Buffer), "[%s] ", Function);
+	
+	if (Length < sizeof(Buffer)) {
+		Length += vsnprintf(Buffer + Length, sizeof(Buffer) - Length, Format, Args);
+	}
+	
+	if (Length > sizeof(Buffer) - 1) {
+		Length = sizeof(Buffer) - 1;
+	}
+	
+	Buffer[Length++] = '\n';
+	
+	ssize_t Written = write(File, Buffer, Length);
+	(void)Written;
+}
+
 void GCTraceX(const char *Function, const char *Format, ...)
 {
 	va_list args;
 	va_start(args, Format);
 	
-	printf("[%s] ", Function);
-	vprintf(Format, args);
-	printf("\n");
+	GCWriteLog(STDOUT_FILENO, Function, Format, args);
 	
 	va_end(args);
 }
@@ -20,9 +47,17 @@ void GCDebugX(const char *Function, const char *Format, ...)
 	va_list args;
 	va_start(args, Format);
 	
-	printf("[%s] ", Function);
-	vprintf(Format, args);
-	printf("\n");
+	GCWriteLog(STDOUT_FILENO, Function, Format, args);
+	
+	va_end(args);
+}
+
+void GCInfoX(const char *Function, const char *Format, ...)
+{
+	va_list args;
+	va_start(args, Format);
+	
+	GCWriteLog(STDOUT_FILENO, Function, Format, args);
 	
 	va_end(args);
 }
@@ -32,9 +67,133 @@ void GCErrorX(const char *Function, const char *Format, ...)
 	va_list args;
 	va_start(args, Format);
 	
-	fprintf(stderr, "[%s] ", Function);
-	vfprintf(stderr, Format, args);
-	fprintf(stderr, "\n");
+	GCWriteLog(STDERR_FILENO, Function, Format, args);
 	
 	va_end(args);
-}
\ No newline at end of file
+}
+
+/*
+ * Sequence is the record's index in the log plus one once
+ * the record is complete, and zero while it is being
+ * written, so a dump can skip records that are torn or
+ * have been overwritten.
+ */
+typedef struct GCEventRecord {
+	uint64_t    Sequence;
+	uint64_t    Time;
+	uintptr_t   Thread;
+	uintptr_t   First;
+	uintptr_t   Second;
+	GCEventType Type;
+} GCEventRecord;
+
+GCEventRecord *GCEvents = NULL;
+
+static size_t EventMask = 0;
+static uint64_t EventHead = 0;
+static pthread_mutex_t EventLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *EventNames[GCEventTypeCount] = {
+	[GCEventRefill]       = "refill",
+	[GCEventLargeAlloc]   = "large-alloc",
+	[GCEventAllocFailed]  = "alloc-failed",
+	[GCEventCollectStart] = "collect-start",
+	[GCEventCollectEnd]   = "collect-end",
+	[GCEventGrowHeap]     = "grow-heap",
+};
+
+void GCEnableEvents(size_t Count)
+{
+	size_t Capacity = 2;
+	while (Capacity < Count) {
+		Capacity *= 2;
+	}
+	
+	pthread_mutex_lock(&EventLock);
+	
+	if (!GCEvents) {
+		GCEventRecord *Events = mmap(NULL, Capacity * sizeof(GCEventRecord),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		
+		if (Events == MAP_FAILED) {
+			GCError("Unable to map an event log of %lu records.", Capacity);
+		}
+		else {
+			EventMask = Capacity - 1;
+			__atomic_store_n(&GCEvents, Events, __ATOMIC_RELEASE);
+		}
+	}
+	
+	pthread_mutex_unlock(&EventLock);
+}
+
+void GCLogEventX(GCEventType Type, uintptr_t First, uintptr_t Second)
+{
+	GCEventRecord *Events = __atomic_load_n(&GCEvents, __ATOMIC_ACQUIRE);
+	uint64_t Index = __atomic_fetch_add(&EventHead, 1, __ATOMIC_RELAXED);
+	GCEventRecord *Record = &Events[Index & EventMask];
+	
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	
+	__atomic_store_n(&Record->Sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	Record->Time   = Now.tv_sec * 1000000000ull + Now.tv_nsec;
+	Record->Thread = (uintptr_t)pthread_self();
+	Record->Type   = Type;
+	Record->First  = First;
+	Record->Second = Second;
+	
+	__atomic_store_n(&Record->Sequence, Index + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Writes the records still in the ring, oldest first, one
+ * per line. Safe to call while other threads keep logging;
+ * records overwritten during the dump are skipped.
+ */
+void GCDumpEvents(int File)
+{
+	GCEventRecord *Events = __atomic_load_n(&GCEvents, __ATOMIC_ACQUIRE);
+	if (!Events) {
+		return;
+	}
+	
+	uint64_t Head = __atomic_load_n(&EventHead, __ATOMIC_ACQUIRE);
+	uint64_t Count = EventMask + 1;
+	uint64_t Start = Head > Count ? Head - Count : 0;
+	
+	for (uint64_t Index = Start; Index < Head; ++Index) {
+		GCEventRecord *Slot = &Events[Index & EventMask];
+		
+		if (__atomic_load_n(&Slot->Sequence, __ATOMIC_ACQUIRE) != Index + 1) {
+			continue;
+		}
+		
+		GCEventRecord Record = *Slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		
+		if (__atomic_load_n(&Slot->Sequence, __ATOMIC_RELAXED) != Index + 1) {
+			continue;
+		}
+		
+		char Buffer[160];
+		int Length = snprintf(Buffer, sizeof(Buffer),
+			"%llu %llu.%09llu %#lx %s %#lx %#lx\n",
+			(unsigned long long)Index,
+			(unsigned long long)(Record.Time / 1000000000ull),
+			(unsigned long long)(Record.Time % 1000000000ull),
+			(unsigned long)Record.Thread,
+			EventNames[Record.Type],
+			(unsigned long)Record.First,
+			(unsigned long)Record.Second);
+		
+		if (Length > sizeof(Buffer) - 1) {
+			Length = sizeof(Buffer) - 1;
+		}
+		
+		ssize_t Written = write(File, Buffer, Length);
+		(void)Written;
+	}
+}
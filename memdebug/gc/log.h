@@ -1,12 +1,80 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Log levels. GC_LOG_LEVEL selects at compile time which
+ * calls are kept, e.g. make CFLAGS+=-DGC_LOG_LEVEL=4. Calls
+ * above the level compile to nothing, arguments included,
+ * so hot paths can log freely. The default keeps errors and
+ * the gcdebug() report.
+ */
+#define GC_LOG_NONE  0
+#define GC_LOG_ERROR 1
+#define GC_LOG_INFO  2
+#define GC_LOG_DEBUG 3
+#define GC_LOG_TRACE 4
+
+#ifndef GC_LOG_LEVEL
+#define GC_LOG_LEVEL GC_LOG_INFO
+#endif
+
 void GCTraceX(const char *Function, const char *Format, ...)
 	__attribute__((format(printf, 2, 3)));
 	
 void GCDebugX(const char *Function, const char *Format, ...)
 	__attribute__((format(printf, 2, 3)));
 	
+void GCInfoX(const char *Function, const char *Format, ...)
+	__attribute__((format(printf, 2, 3)));
+
 void GCErrorX(const char *Function, const char *Format, ...)
 	__attribute__((format(printf, 2, 3)));
 	
-#define GCTrace(Format, ...) GCTraceX(__func__, Format, ##__VA_ARGS__)
-#define GCDebug(Format, ...) GCDebugX(__func__, Format, ##__VA_ARGS__)
-#define GCError(Format, ...) GCDebugX(__func__, Format, ##__VA_ARGS__)
\ No newline at end of file
+/*
+ * A disabled call is kept behind if (0) rather than removed
+ * so that its format string is still checked and variables
+ * used only for logging do not trigger warnings.
+ */
+#define GCLogAt(Level, Log, Format, ...) \
+	do { \
+		if (GC_LOG_LEVEL >= Level) \
+			Log(__func__, Format, ##__VA_ARGS__); \
+	} while (0)
+
+#define GCTrace(Format, ...) GCLogAt(GC_LOG_TRACE, GCTraceX, Format, ##__VA_ARGS__)
+#define GCDebug(Format, ...) GCLogAt(GC_LOG_DEBUG, GCDebugX, Format, ##__VA_ARGS__)
+#define GCInfo(Format, ...)  GCLogAt(GC_LOG_INFO,  GCInfoX,  Format, ##__VA_ARGS__)
+#define GCError(Format, ...) GCLogAt(GC_LOG_ERROR, GCErrorX, Format, ##__VA_ARGS__)
+
+/*
+ * The event log is a fixed-size ring of structured records
+ * kept in memory for post-mortem dumps. It is off until
+ * GCEnableEvents() is called, or GC_EVENT_LOG is set to the
+ * number of records to keep. Writers claim slots with an
+ * atomic increment and never block, so events can be logged
+ * from any thread, including while the world is stopped.
+ * Once the ring is full the oldest records are overwritten.
+ */
+typedef enum GCEventType {
+	GCEventRefill,
+	GCEventLargeAlloc,
+	GCEventAllocFailed,
+	GCEventCollectStart,
+	GCEventCollectEnd,
+	GCEventGrowHeap,
+	GCEventTypeCount
+} GCEventType;
+
+typedef struct GCEventRecord GCEventRecord;
+
+extern GCEventRecord *GCEvents;
+
+void GCEnableEvents(size_t Count);
+void GCLogEventX(GCEventType Type, uintptr_t First, uintptr_t Second);
+void GCDumpEvents(int File);
+
+#define GCEvent(Type, First, Second) \
+	do { \
+		if (GCEvents) \
+			GCLogEventX(Type, (uintptr_t)(First), (uintptr_t)(Second)); \
+	} while (0)
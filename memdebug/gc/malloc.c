@@ -1,9 +1,75 @@
 #include "gc.h"
+#include "log.h"
 #include "malloc.h"
+#include "thread.h"
 
 void *gcmalloc(size_t Size)
 {
-	return GCGetBuffer(GCAlloc(Size));
+	return gcmalloc_typed(Size, NULL);
+}
+
+void *gcmalloc_typed(size_t Size, const GCLayout *Layout)
+{
+	GCObject *Object = GCAllocTyped(Size, Layout);
+	return Object ? GCGetBuffer(Object) : NULL;
+}
+
+GCLayout *gclayout(size_t Size, const size_t *PointerOffsets, size_t PointerCount)
+{
+	return GCCreateLayout(Size, PointerOffsets, PointerCount);
+}
+
+void gcadd_root(void **Root)
+{
+	GCAddRoot(Root);
+}
+
+void gcadd_roots(void *Base, size_t Size)
+{
+	GCAddRootRange(Base, Size);
+}
+
+void gcremove_root(void *Base)
+{
+	GCRemoveRoot(Base);
+}
+
+void gcscan_stack(bool Enabled)
+{
+	GCSetStackScanning(Enabled);
+}
+
+void gcregister_finalizer(
+	void  *Buffer,
+	void (*Finalizer)(void *Buffer, void *Context),
+	void  *Context)
+{
+	GCRegisterFinalizer(GCGetObject(Buffer), Finalizer, Context);
+}
+
+GCWeak *gcweak(void *Buffer)
+{
+	return GCCreateWeak(Buffer);
+}
+
+void *gcweak_get(GCWeak *Weak)
+{
+	return GCGetWeak(Weak);
+}
+
+void gcweak_free(GCWeak *Weak)
+{
+	GCDestroyWeak(Weak);
+}
+
+void gcregister_thread()
+{
+	GCRegisterThread();
+}
+
+void gcunregister_thread()
+{
+	GCUnregisterThread();
 }
 
 void gcdebug()
@@ -15,4 +81,26 @@ void gcdebug()
 void gccollect()
 {
 	GCCollect();
-}
\ No newline at end of file
+}
+
+void gcevents(size_t Count)
+{
+	GCEnableEvents(Count);
+}
+
+void gcdump_events(int File)
+{
+	GCDumpEvents(File);
+}
+
+void gcstats(GCStats *Stats)
+{
+	GCGetStats(Stats);
+}
+
+void gcdump_stats(int File)
+{
+	GCStats Stats;
+	GCGetStats(&Stats);
+	GCDumpStats(File, &Stats);
+}
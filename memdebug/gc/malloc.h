@@ -1,5 +1,105 @@
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "stats.h"
+
+typedef struct GCLayout GCLayout;
+typedef struct GCWeak GCWeak;
+
+/*
+ * gcmalloc() collects on its own once enough has been
+ * allocated since the last collection, and grows the heap
+ * when collecting does not free enough. The policy is read
+ * from the environment:
+ *
+ *    GC_PERCENT       Collect after allocating this percent
+ *                     of the live heap (default 100), or
+ *                     "off" to collect only in gccollect()
+ *                     and when the heap is full.
+ *    GC_MIN_TRIGGER   Never collect after allocating less
+ *                     than this (default 256K).
+ *    GC_INITIAL_HEAP  Initial heap size (default 1M).
+ *    GC_MAX_HEAP      Heap size limit, 0 for none (default).
+ *                     Allocation returns NULL past it.
+ *    GC_LARGE_OBJECT  Map objects of at least this size on
+ *                     their own (default 128K).
+ *    GC_COMPACT       Compact the heap every N collections,
+ *                     0 for never (default).
+ *    GC_ZERO          1 to zero free memory on a background
+ *                     thread after collections, so that
+ *                     allocation does not have to, 0 to
+ *                     zero on allocation only (default 1
+ *                     on more than one processor).
+ *
+ * Compaction moves objects that are only referenced from
+ * typed objects' pointer words, precise roots (gcadd_root)
+ * and weak references, and updates those references.
+ * Anything referenced from a stack, a root range or an
+ * untyped object stays where it is. Large objects never
+ * move, and are unmapped when they die.
+ */
 void *gcmalloc(size_t Size);
 void  gcdebug();
-void  gccollect();
\ No newline at end of file
+void  gccollect();
+
+/*
+ * The event log keeps the last Count collector events
+ * (buffer refills, large allocations, collections, heap
+ * growth) in memory. gcdump_events() writes them to File,
+ * oldest first, e.g. from a crash handler. The log can also
+ * be turned on by setting GC_EVENT_LOG to a record count.
+ */
+void  gcevents(size_t Count);
+void  gcdump_events(int File);
+
+/*
+ * Collector statistics: collections, pause times by phase,
+ * bytes allocated and reclaimed, live heap, fragmentation
+ * and mark stack depth. See stats.h. Reading them is cheap
+ * enough to poll. Setting GC_STATS_EVERY=N also dumps them
+ * to stderr every N collections.
+ */
+void  gcstats(GCStats *Stats);
+void  gcdump_stats(int File);
+
+/*
+ * Typed allocation. See GCLayout in gc.h.
+ * gclayout() builds a layout for an object of Size bytes
+ * whose pointers live at the given byte offsets, e.g.
+ *
+ *    size_t Offsets[] = { offsetof(struct A, b) };
+ *    GCLayout *LayoutA = gclayout(sizeof(struct A), Offsets, 1);
+ *
+ * gclayout(Size, NULL, 0) describes a pointer-free object,
+ * which is never scanned; use it for large data buffers.
+ */
+GCLayout *gclayout(size_t Size, const size_t *PointerOffsets, size_t PointerCount);
+void     *gcmalloc_typed(size_t Size, const GCLayout *Layout);
+
+void  gcadd_root(void **Root);
+void  gcadd_roots(void *Base, size_t Size);
+void  gcremove_root(void *Base);
+void  gcscan_stack(bool Enabled);
+
+/*
+ * Finalizers and weak references. See GCRegisterFinalizer()
+ * and GCCreateWeak() in gc.h. A cache can hold its entries
+ * through weak references, so that collections shrink it
+ * when nothing else uses an entry.
+ */
+void    gcregister_finalizer(
+	void  *Buffer,
+	void (*Finalizer)(void *Buffer, void *Context),
+	void  *Context);
+
+GCWeak *gcweak(void *Buffer);
+void   *gcweak_get(GCWeak *Weak);
+void    gcweak_free(GCWeak *Weak);
+
+/*
+ * Threads are registered automatically when they first
+ * allocate. A thread that only reads collected objects
+ * must register itself so its stack is scanned.
+ */
+void  gcregister_thread();
+void  gcunregister_thread();
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+double GCNow()
+{
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return Time.tv_sec + Time.tv_nsec / 1e9;
+}
+
+/*
+ * Formatted on the stack and written in one write() for
+ * the same reason as log messages: this can run while
+ * another thread holds the stdio lock.
+ */
+void GCDumpStats(int File, const GCStats *Stats)
+{
+	char Buffer[1024];
+	int Length = snprintf(Buffer, sizeof(Buffer),
+		"collections        %lu\n"
+		"pause total        %.3f ms\n"
+		"pause last         %.3f ms\n"
+		"pause max          %.3f ms\n"
+		"  suspend          %.3f ms\n"
+		"  root scan        %.3f ms\n"
+		"  mark             %.3f ms\n"
+		"  sweep            %.3f ms\n"
+		"  compact          %.3f ms\n"
+		"allocated          %lu bytes in %lu objects\n"
+		"reclaimed          %lu bytes in %lu objects\n"
+		"finalized          %lu objects\n"
+		"moved              %lu bytes in %lu objects\n"
+		"zeroed             %lu blocks\n"
+		"heap size          %lu bytes\n"
+		"live               %lu bytes\n"
+		"free               %lu bytes, largest block %lu\n"
+		"fragmentation      %.1f%%\n"
+		"mark stack peak    %lu entries\n",
+		Stats->Collections,
+		Stats->TotalPause * 1e3,
+		Stats->LastPause * 1e3,
+		Stats->MaximumPause * 1e3,
+		Stats->SuspendTime * 1e3,
+		Stats->RootScanTime * 1e3,
+		Stats->MarkTime * 1e3,
+		Stats->SweepTime * 1e3,
+		Stats->CompactTime * 1e3,
+		Stats->AllocatedBytes, Stats->AllocatedObjects,
+		Stats->ReclaimedBytes, Stats->ReclaimedObjects,
+		Stats->Finalized,
+		Stats->MovedBytes, Stats->MovedObjects,
+		Stats->ZeroedBlocks,
+		Stats->HeapSize,
+		Stats->LiveBytes,
+		Stats->FreeBytes, Stats->LargestFreeBlock,
+		Stats->Fragmentation * 100,
+		Stats->MarkStackHighWater);
+	
+	if (Length > sizeof(Buffer) - 1) {
+		Length = sizeof(Buffer) - 1;
+	}
+	
+	ssize_t Written = write(File, Buffer, Length);
+	(void)Written;
+}
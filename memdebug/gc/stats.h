@@ -0,0 +1,52 @@
+#include <stddef.h>
+
+/*
+ * Collector statistics, as returned by GCGetStats(). Times
+ * are in seconds. Phase times are summed over all
+ * collections; together with SuspendTime they make up
+ * TotalPause.
+ *
+ * Fragmentation is 1 - LargestFreeBlock / FreeBytes: 0
+ * when all free memory is one block, approaching 1 when it
+ * is scattered over many small ones.
+ */
+typedef struct GCStats {
+	unsigned long Collections;
+	
+	double SuspendTime;
+	double RootScanTime;
+	double MarkTime;
+	double SweepTime;
+	double CompactTime;
+	
+	double LastPause;
+	double MaximumPause;
+	double TotalPause;
+	
+	size_t AllocatedBytes;    /* Since the program started */
+	size_t AllocatedObjects;
+	size_t ReclaimedBytes;
+	size_t ReclaimedObjects;
+	size_t Finalized;
+	size_t MovedBytes;        /* By compaction */
+	size_t MovedObjects;
+	size_t ZeroedBlocks;      /* In the background */
+	
+	size_t HeapSize;
+	size_t LiveBytes;         /* After the last collection */
+	size_t FreeBytes;
+	size_t LargestFreeBlock;
+	double Fragmentation;
+	
+	size_t MarkStackHighWater;  /* Entries */
+} GCStats;
+
+/*
+ * Monotonic time in seconds, for timing collector phases.
+ */
+double GCNow();
+
+/*
+ * Writes Stats to File in a human-readable form.
+ */
+void   GCDumpStats(int File, const GCStats *Stats);
@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "malloc.h"
+
+/*
+ * Many threads build and drop linked lists concurrently,
+ * and every thread triggers collections. Each thread keeps
+ * a few lists reachable only from its own stack and checks
+ * them after every round, so a collection that misses a
+ * thread's stack or registers, or corrupts the heap, shows
+ * up as a checksum mismatch.
+ */
+
+#define THREAD_COUNT  8
+#define ROUNDS        100
+#define LIVE_LISTS    4
+#define LIST_LENGTH   64
+#define COLLECT_EVERY 16
+
+struct Node {
+	struct Node *Next;
+	long Value;
+	long *Payload;
+};
+
+static GCLayout *NodeLayout;
+static GCLayout *PayloadLayout;
+
+static void *Allocate(size_t Size, const GCLayout *Layout)
+{
+	void *Buffer = gcmalloc_typed(Size, Layout);
+	if (!Buffer) {
+		fprintf(stderr, "Out of memory\n");
+		abort();
+	}
+	
+	return Buffer;
+}
+
+static struct Node *BuildList(long Seed)
+{
+	struct Node *Head = NULL;
+	
+	for (long i = 0; i < LIST_LENGTH; ++i) {
+		struct Node *Node = Allocate(sizeof(struct Node), 
+			(i % 2) ? NodeLayout : NULL);
+		Node->Value = Seed + i;
+		Node->Payload = Allocate(sizeof(long) * 4, PayloadLayout);
+		Node->Payload[0] = Seed ^ i;
+		Node->Next = Head;
+		Head = Node;
+	}
+	
+	return Head;
+}
+
+static void CheckList(const struct Node *Head, long Seed)
+{
+	long i = LIST_LENGTH;
+	
+	for (; Head; Head = Head->Next) {
+		--i;
+		if (Head->Value != Seed + i || Head->Payload[0] != (Seed ^ i)) {
+			fprintf(stderr, "List %ld corrupted at node %ld\n", Seed, i);
+			gcdump_events(STDERR_FILENO);
+			abort();
+		}
+	}
+	
+	if (i != 0) {
+		fprintf(stderr, "List %ld lost %ld nodes\n", Seed, i);
+		gcdump_events(STDERR_FILENO);
+		abort();
+	}
+}
+
+static void *Mutate(void *Argument)
+{
+	long Thread = (long)Argument;
+	struct Node *Live[LIVE_LISTS];
+	long Seeds[LIVE_LISTS];
+	
+	for (int i = 0; i < LIVE_LISTS; ++i) {
+		Seeds[i] = Thread * 1000000 + i;
+		Live[i] = BuildList(Seeds[i]);
+	}
+	
+	for (long Round = 0; Round < ROUNDS; ++Round) {
+		/* Garbage */
+		BuildList(-1);
+		
+		int Slot = Round % LIVE_LISTS;
+		Seeds[Slot] = Thread * 1000000 + Round * LIVE_LISTS + Slot;
+		Live[Slot] = BuildList(Seeds[Slot]);
+		
+		if (Round % COLLECT_EVERY == Thread % COLLECT_EVERY) {
+			gccollect();
+		}
+		
+		for (int i = 0; i < LIVE_LISTS; ++i) {
+			CheckList(Live[i], Seeds[i]);
+		}
+	}
+	
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t NodeOffsets[] = {
+		offsetof(struct Node, Next),
+		offsetof(struct Node, Payload)
+	};
+	
+	NodeLayout = gclayout(sizeof(struct Node), NodeOffsets, 2);
+	PayloadLayout = gclayout(sizeof(long) * 4, NULL, 0);
+	
+	pthread_t Threads[THREAD_COUNT];
+	
+	for (long i = 0; i < THREAD_COUNT; ++i) {
+		int Result = pthread_create(&Threads[i], NULL, Mutate, (void*)i);
+		assert(Result == 0);
+	}
+	
+	for (int i = 0; i < THREAD_COUNT; ++i) {
+		pthread_join(Threads[i], NULL);
+	}
+	
+	printf("%d threads completed %d rounds each\n", THREAD_COUNT, ROUNDS);
+	
+	return 0;
+}
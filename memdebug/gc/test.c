@@ -1,4 +1,8 @@
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "malloc.h"
 
@@ -25,6 +29,34 @@ struct A {
 	struct D *d;
 };
 
+static GCLayout *LayoutA;
+static GCLayout *LayoutB;
+static GCLayout *LayoutC;
+static GCLayout *LayoutD;
+
+static struct A *Root;
+static struct D *Chain;
+static void **Large;
+
+static int Finalized = 0;
+
+void CreateLayouts()
+{
+	size_t OffsetsA[] = {
+		offsetof(struct A, a),
+		offsetof(struct A, b),
+		offsetof(struct A, c),
+		offsetof(struct A, d)
+	};
+	size_t OffsetsC[] = { offsetof(struct C, d) };
+	size_t OffsetsD[] = { offsetof(struct D, c) };
+	
+	LayoutA = gclayout(sizeof(struct A), OffsetsA, 4);
+	LayoutB = gclayout(sizeof(struct B), NULL, 0);
+	LayoutC = gclayout(sizeof(struct C), OffsetsC, 1);
+	LayoutD = gclayout(sizeof(struct D), OffsetsD, 1);
+}
+
 struct A *Allocate()
 {
 	struct A *a = gcmalloc(sizeof(struct A));
@@ -39,6 +71,19 @@ struct A *Allocate()
 	return a;
 }
 
+struct A *AllocateTyped()
+{
+	struct A *a = gcmalloc_typed(sizeof(struct A), LayoutA);
+	a->b = gcmalloc_typed(sizeof(struct B), LayoutB);
+	a->c = gcmalloc_typed(sizeof(struct C), LayoutC);
+	a->d = gcmalloc_typed(sizeof(struct D), LayoutD);
+	a->c->d = gcmalloc_typed(sizeof(struct D), LayoutD);
+	a->d->c = a->c;
+	a->c->d->c = a->c;
+	
+	return a;
+}
+
 void **AllocateArray()
 {
 	void **a = gcmalloc(sizeof(void*) * 2);
@@ -63,16 +108,180 @@ void leak2()
 	printf("%p\n", a);
 }
 
+void CountFinalized(void *Buffer, void *Context)
+{
+	__atomic_add_fetch((int*)Context, 1, __ATOMIC_RELAXED);
+}
+
+GCWeak *AllocateFinalized()
+{
+	struct B *b = gcmalloc_typed(sizeof(struct B), LayoutB);
+	gcregister_finalizer(b, CountFinalized, &Finalized);
+	GCWeak *Weak = gcweak(b);
+	
+	/* The most recent allocation is always kept alive */
+	gcmalloc(sizeof(long));
+	
+	return Weak;
+}
+
+/*
+ * Builds a chain of typed objects reachable only from a
+ * precise root, scattered among garbage so that their
+ * segment is sparse once collected, and checks that it
+ * is compacted and survives it intact.
+ */
+int CheckCompaction()
+{
+	GCStats Before;
+	gcstats(&Before);
+	gcadd_root((void**)&Chain);
+	
+	for (long i = 0; i < 100000; ++i) {
+		struct D *d = gcmalloc_typed(sizeof(struct D), LayoutD);
+		d->x = i;
+		
+		if (i % 16 == 0) {
+			d->c = (struct C*)Chain;
+			Chain = d;
+		}
+	}
+	
+	gccollect();
+	GCStats After;
+	gcstats(&After);
+	
+	long Count = 0;
+	for (struct D *d = Chain; d; d = (struct D*)d->c) {
+		if (d->x != 100000 - 16 - Count * 16) {
+			printf("Chain corrupted at %ld\n", Count);
+			return 1;
+		}
+		++Count;
+	}
+	
+	printf("Chain of %ld objects intact, %lu moved\n",
+		Count, After.MovedObjects - Before.MovedObjects);
+	
+	Chain = NULL;
+	
+	/* Every collection compacts with GC_COMPACT=1 */
+	const char *Compact = getenv("GC_COMPACT");
+	return Compact && atoi(Compact) == 1 &&
+		After.MovedObjects == Before.MovedObjects;
+}
+
+/*
+ * Keeps a small object alive through a large untyped one,
+ * and hides another in a large pointer-free one, which is
+ * never scanned, so only the first survives. Dropping the
+ * large objects must give their mappings back.
+ */
+GCWeak *AllocateLarge(size_t Size)
+{
+	Large = gcmalloc(Size);
+	Large[0] = gcmalloc_typed(sizeof(struct D), LayoutD);
+	((struct D*)Large[0])->x = 42;
+	
+	void **Data = gcmalloc_typed(Size, gclayout(sizeof(long), NULL, 0));
+	Large[1] = Data;
+	Data[0] = gcmalloc_typed(sizeof(struct D), LayoutD);
+	GCWeak *Weak = gcweak(Data[0]);
+	
+	gcmalloc(sizeof(long));
+	return Weak;
+}
+
+int CheckLargeObjects()
+{
+	size_t Size = 1024 * 1024;
+	gcadd_root((void**)&Large);
+	GCWeak *Weak = AllocateLarge(Size);
+	
+	gccollect();
+	GCStats Before;
+	gcstats(&Before);
+	
+	if (((struct D*)Large[0])->x != 42 || gcweak_get(Weak)) {
+		printf("Large objects scanned wrongly\n");
+		return 1;
+	}
+	
+	/* Swept mappings are cached until the next collection */
+	Large = NULL;
+	gcmalloc(sizeof(long));
+	gccollect();
+	gccollect();
+	GCStats After;
+	gcstats(&After);
+	gcweak_free(Weak);
+	
+	int Unmapped = After.HeapSize + 2 * Size <= Before.HeapSize;
+	printf("Large objects unmapped: %s\n", Unmapped ? "yes" : "no");
+	return !Unmapped;
+}
+
+/*
+ * With GC_PERCENT=off a full heap must still collect rather
+ * than fail at GC_MAX_HEAP. Run in a child, since the policy
+ * is read once, before the first allocation.
+ */
+int CheckFullHeap()
+{
+	pid_t Child = fork();
+	if (Child == 0) {
+		setenv("GC_PERCENT", "off", 1);
+		setenv("GC_MAX_HEAP", "4M", 1);
+		for (int i = 0; i < 200000; ++i) {
+			if (!gcmalloc(128)) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	
+	int Status;
+	int Failed = Child < 0 || waitpid(Child, &Status, 0) < 0 ||
+		!WIFEXITED(Status) || WEXITSTATUS(Status) != 0;
+	printf("Full heap with GC_PERCENT=off: %s\n",
+		Failed ? "out of memory" : "collected");
+	return Failed;
+}
+
 int main(int argc, char *argv[])
 {
+	if (CheckFullHeap()) {
+		return 1;
+	}
+	
+	setenv("GC_COMPACT", "1", 0);
+	
 	//struct A *a = Allocate();
 	void **arr = AllocateArray();
 	
 	leak();
 	leak2();
 	
+	CreateLayouts();
+	gcadd_root((void**)&Root);
+	Root = AllocateTyped();
+	
+	GCWeak *Weak = AllocateFinalized();
+	
 	gccollect();
 	gcdebug();
 
-	return 0;
+	for (int i = 0; i < 100 && !__atomic_load_n(&Finalized, __ATOMIC_RELAXED); ++i) {
+		usleep(10000);
+	}
+	
+	int Cleared = !gcweak_get(Weak);
+	printf("Weak reference %s, %d finalizer(s) run\n",
+		Cleared ? "cleared" : "alive", Finalized);
+	gcweak_free(Weak);
+	if (!Cleared || Finalized == 0) {
+		return 1;
+	}
+	
+	return CheckCompaction() || CheckLargeObjects();
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "gc.h"
+#include "log.h"
+#include "thread.h"
+
+static pthread_mutex_t ThreadsLock = PTHREAD_MUTEX_INITIALIZER;
+static GCThread *Threads = NULL;
+
+static __thread GCThread *CurrentThread = NULL;
+
+/*
+ * Unregisters threads as they exit. The key's value is the
+ * thread's GCThread.
+ */
+static pthread_key_t ThreadKey;
+static pthread_once_t ThreadsOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * Suspended threads post AckSemaphore once when they have
+ * saved their state and again when they resume, so the
+ * collector knows when the world has stopped and when it
+ * may be stopped again.
+ */
+static sem_t AckSemaphore;
+static volatile sig_atomic_t WorldStopped = 0;
+static int SuspendedCount = 0;
+
+static void InitializeThreads();
+static void DestroyThread(void *Value);
+static void GetStackBounds(GCThread *Thread);
+static void SuspendHandler(int Signal);
+static void RestartHandler(int Signal);
+static void WaitForRestart(GCThread *Thread);
+static void WaitForAcks(int Count);
+
+GCThread *GCRegisterThread()
+{
+	if (CurrentThread) {
+		return CurrentThread;
+	}
+	
+	pthread_once(&ThreadsOnce, InitializeThreads);
+	
+	GCThread *Thread = calloc(1, sizeof(GCThread));
+	assert(Thread);
+	
+	Thread->Handle = pthread_self();
+	GetStackBounds(Thread);
+	
+	GCDebug("Registering thread with stack %p-%p",
+		Thread->StackLimit, Thread->StackBase);
+	
+	/*
+	 * The suspend handler looks the thread up through
+	 * CurrentThread, so set it before the collector can
+	 * see the thread.
+	 */
+	CurrentThread = Thread;
+	pthread_setspecific(ThreadKey, Thread);
+	
+	GCLockThreads();
+	Thread->Next = Threads;
+	Threads = Thread;
+	GCUnlockThreads();
+	
+	return Thread;
+}
+
+void GCUnregisterThread()
+{
+	GCThread *Thread = CurrentThread;
+	if (!Thread) {
+		return;
+	}
+	
+	pthread_setspecific(ThreadKey, NULL);
+	DestroyThread(Thread);
+}
+
+GCThread *GCCurrentThread()
+{
+	if (CurrentThread) {
+		return CurrentThread;
+	}
+	
+	return GCRegisterThread();
+}
+
+GCThread *GCFirstThread()
+{
+	return Threads;
+}
+
+void GCLockThreads()
+{
+	pthread_mutex_lock(&ThreadsLock);
+}
+
+void GCUnlockThreads()
+{
+	pthread_mutex_unlock(&ThreadsLock);
+}
+
+void GCStopWorld()
+{
+	GCThread *Self = CurrentThread;
+	
+	WorldStopped = 1;
+	SuspendedCount = 0;
+	
+	for (GCThread *Thread = Threads; Thread; Thread = Thread->Next) {
+		if (Thread == Self) {
+			continue;
+		}
+		
+		int Result = pthread_kill(Thread->Handle, GCSuspendSignal);
+		assert(Result == 0);
+		++SuspendedCount;
+	}
+	
+	WaitForAcks(SuspendedCount);
+	
+	GCDebug("Suspended %d threads", SuspendedCount);
+}
+
+void GCStartWorld()
+{
+	GCThread *Self = CurrentThread;
+	
+	WorldStopped = 0;
+	
+	for (GCThread *Thread = Threads; Thread; Thread = Thread->Next) {
+		if (Thread == Self) {
+			continue;
+		}
+		
+		int Result = pthread_kill(Thread->Handle, GCRestartSignal);
+		assert(Result == 0);
+	}
+	
+	WaitForAcks(SuspendedCount);
+}
+
+void GCSuspendSelf(GCThread *Thread)
+{
+	/*
+	 * Spill the callee-saved registers into this frame,
+	 * which lies above the StackPointer WaitForRestart()
+	 * records.
+	 */
+	jmp_buf Registers;
+	__builtin_unwind_init();
+	setjmp(Registers);
+	
+	Thread->SuspendPending = 0;
+	WaitForRestart(Thread);
+}
+
+static __attribute__((noinline)) void WaitForRestart(GCThread *Thread)
+{
+	sigset_t Blocked;
+	sigset_t Previous;
+	sigemptyset(&Blocked);
+	sigaddset(&Blocked, GCSuspendSignal);
+	sigaddset(&Blocked, GCRestartSignal);
+	pthread_sigmask(SIG_BLOCK, &Blocked, &Previous);
+	
+	Thread->StackPointer = __builtin_frame_address(0);
+	sem_post(&AckSemaphore);
+	
+	/*
+	 * The restart signal stays blocked outside of
+	 * sigsuspend(), so it cannot be lost between checking
+	 * WorldStopped and going to sleep.
+	 */
+	sigset_t Mask;
+	sigfillset(&Mask);
+	sigdelset(&Mask, GCRestartSignal);
+	
+	while (WorldStopped) {
+		sigsuspend(&Mask);
+	}
+	
+	Thread->StackPointer = NULL;
+	pthread_sigmask(SIG_SETMASK, &Previous, NULL);
+	
+	sem_post(&AckSemaphore);
+}
+
+static void WaitForAcks(int Count)
+{
+	for (int i = 0; i < Count; ++i) {
+		while (sem_wait(&AckSemaphore) != 0) {
+			assert(errno == EINTR);
+		}
+	}
+}
+
+static void SuspendHandler(int Signal)
+{
+	int SavedErrno = errno;
+	GCThread *Thread = CurrentThread;
+	
+	assert(Thread);
+	
+	if (Thread->NoSuspend) {
+		Thread->SuspendPending = 1;
+	}
+	else {
+		GCSuspendSelf(Thread);
+	}
+	
+	errno = SavedErrno;
+}
+
+static void RestartHandler(int Signal)
+{
+}
+
+static void InitializeThreads()
+{
+	int Result = pthread_key_create(&ThreadKey, DestroyThread);
+	assert(Result == 0);
+	
+	Result = sem_init(&AckSemaphore, 0, 0);
+	assert(Result == 0);
+	
+	struct sigaction Action = { 0 };
+	Action.sa_flags = SA_RESTART;
+	sigfillset(&Action.sa_mask);
+	
+	Action.sa_handler = SuspendHandler;
+	Result = sigaction(GCSuspendSignal, &Action, NULL);
+	assert(Result == 0);
+	
+	Action.sa_handler = RestartHandler;
+	Result = sigaction(GCRestartSignal, &Action, NULL);
+	assert(Result == 0);
+}
+
+static void DestroyThread(void *Value)
+{
+	GCThread *Thread = Value;
+	
+	GCReleaseThread(Thread);
+	
+	GCLockThreads();
+	
+	GCThread **Link = &Threads;
+	for (; *Link != Thread; Link = &(*Link)->Next) {
+		assert(*Link);
+	}
+	*Link = Thread->Next;
+	
+	GCUnlockThreads();
+	
+	CurrentThread = NULL;
+	free(Thread);
+}
+
+/*
+ * Reads the stack bounds once per thread, instead of
+ * parsing /proc/self/stat on every collection. For the
+ * main thread glibc derives the bounds from the stack
+ * mapping and the stack size limit.
+ */
+static void GetStackBounds(GCThread *Thread)
+{
+	pthread_attr_t Attributes;
+	void *Address;
+	size_t Size;
+	
+	int Result = pthread_getattr_np(Thread->Handle, &Attributes);
+	assert(Result == 0);
+	
+	Result = pthread_attr_getstack(&Attributes, &Address, &Size);
+	assert(Result == 0);
+	
+	pthread_attr_destroy(&Attributes);
+	
+	Thread->StackLimit = Address;
+	Thread->StackBase = (char*)Address + Size;
+}
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+
+/*
+ * A GCThread records what the collector needs to know
+ * about a mutator thread: the bounds of its stack, which
+ * are looked up once when the thread is registered, and
+ * its thread-local allocation buffer.
+ *
+ * Threads are registered implicitly the first time they
+ * call into the collector, and unregistered when they
+ * exit. A thread that holds pointers to collected objects
+ * but never allocates must call GCRegisterThread()
+ * itself, or its stack will not be scanned.
+ */
+typedef struct GCThread GCThread;
+typedef struct GCObject GCObject;
+
+typedef struct GCThread {
+	pthread_t Handle;
+	void *StackBase;     /* Highest address of the stack */
+	void *StackLimit;    /* Lowest address of the stack */
+	void *StackPointer;  /* Where scanning starts while suspended */
+	
+	/*
+	 * The thread-local allocation buffer. Objects are
+	 * carved from [AllocCursor, AllocEnd) without taking
+	 * the heap lock. Objects between AllocStart and
+	 * AllocCursor are handed to the collector when the
+	 * buffer is retired. AllocClean is set when the buffer
+	 * was zero when it was taken, so objects carved from it
+	 * need no zeroing.
+	 */
+	char *AllocStart;
+	char *AllocCursor;
+	char *AllocEnd;
+	bool  AllocClean;
+	
+	/*
+	 * The object most recently handed out to this thread.
+	 * Until the allocator returns, the thread may only hold
+	 * a pointer to the object's header, which stack
+	 * scanning does not recognize, so the collector treats
+	 * it as a root.
+	 */
+	GCObject *LastObject;
+	
+	/*
+	 * Bytes and objects this thread has allocated. Only
+	 * the thread writes them, so counting costs no atomic
+	 * operations; GCGetStats() sums them over all threads.
+	 */
+	size_t AllocatedBytes;
+	size_t AllocatedObjects;
+	
+	/*
+	 * Set while the thread is in a section that must not
+	 * be interrupted by a collection, such as carving an
+	 * object out of its allocation buffer. A suspend
+	 * request that arrives meanwhile is deferred until the
+	 * section ends.
+	 */
+	volatile sig_atomic_t NoSuspend;
+	volatile sig_atomic_t SuspendPending;
+	
+	GCThread *Next;
+} GCThread;
+
+/*
+ * Signals used to stop and restart the world. These are
+ * the same signals other conservative collectors use on
+ * Linux, so programs rarely depend on them.
+ */
+#define GCSuspendSignal SIGPWR
+#define GCRestartSignal SIGXCPU
+
+GCThread *GCRegisterThread();
+void      GCUnregisterThread();
+
+/*
+ * Returns the calling thread, registering it if needed.
+ */
+GCThread *GCCurrentThread();
+
+/*
+ * Iterates through the registered threads:
+ *    for (GCThread *Thread = GCFirstThread(); Thread; Thread = Thread->Next)
+ *
+ * The thread list must not change while iterating, so
+ * callers must hold GCLockThreads().
+ */
+GCThread *GCFirstThread();
+void      GCLockThreads();
+void      GCUnlockThreads();
+
+/*
+ * Suspends every registered thread but the caller, and
+ * resumes them again. The caller must hold GCLockThreads()
+ * across both calls. While the world is stopped, each
+ * suspended thread's registers have been spilled onto its
+ * stack below StackPointer's frame, so scanning from
+ * StackPointer to StackBase covers them.
+ */
+void      GCStopWorld();
+void      GCStartWorld();
+
+void      GCSuspendSelf(GCThread *Thread);
+
+static inline void GCEnterNoSuspend(GCThread *Thread)
+{
+	Thread->NoSuspend = 1;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void GCLeaveNoSuspend(GCThread *Thread)
+{
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	Thread->NoSuspend = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	
+	if (Thread->SuspendPending) {
+		GCSuspendSelf(Thread);
+	}
+}
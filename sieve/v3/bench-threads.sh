@@ -0,0 +1,28 @@
+#!/bin/bash
+# Times sieve/v3 at thread counts from 1 up to the number of
+# processors, counting the primes below max (default 10^11) so that
+# the sieve is measured rather than the output. Pass --print to
+# print them to /dev/null instead.
+#
+# usage: bench-threads.sh [max] [--count | --print]
+
+max=${1:-100000000000}
+mode=${2:---count}
+cpus=$(nproc)
+
+case $mode in
+  --count) flags=--count ;;
+  --print) flags= ;;
+  *) echo "usage: bench-threads.sh [max] [--count | --print]" >&2; exit 1 ;;
+esac
+
+cd "$(dirname "$0")"
+gcc sieve.c libsieve.c lmo.c -O2 -g -pthread -lm -o sieve || exit 1
+
+echo "$cpus cpus"
+TIMEFORMAT="%R s real, %U s user"
+for ((j = 1; j < 2 * cpus; j *= 2)); do
+  ((j > cpus)) && j=$cpus
+  echo -n "$max -j $j: "
+  time ./sieve -j $j $flags $max > /dev/null || exit 1
+done
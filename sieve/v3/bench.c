@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "libsieve.h"
+#include "lmo.h"
+
+// gcc bench.c libsieve.c lmo.c -O2 -g -pthread -lm -o bench
+
+// Times each way of counting the primes below N, for N = 10^3 up
+// to 10^max_exponent (default 10):
+//
+// $ ./bench [max_exponent] [strategy...]
+//
+//   v1        a byte per number, set by a loop, as v1/sieve.c
+//   v2        a byte per number, set by memset, as v2/sieve.c
+//   v3        the mod 30 wheel a segment at a time, with popcount
+//   iterator  the same wheel, prime by prime through sieve_next
+//   lmo       Lagarias-Miller-Odlyzko, without sieving to N
+//
+// Each run happens in a child of its own, so that its peak RSS can
+// be read back, and is repeated until it has taken BENCH_SECONDS
+// to even out small N. All strategies must agree on the count.
+
+#define BENCH_SECONDS 0.2
+
+// The byte maps are skipped beyond this.
+#define BYTE_MAP_LIMIT ((uint64_t)1 << 31)
+
+struct strategy {
+  const char *name;
+  int64_t (*count)(uint64_t n);
+  uint64_t limit;
+};
+
+struct result {
+  int64_t count;
+  uint64_t runs;
+  double seconds;
+};
+
+static int64_t
+count_v1(uint64_t n)
+{
+  char *is_prime = malloc(n);
+  if (!is_prime) {
+    return -1;
+  }
+
+  for (uint64_t i = 0; i < n; i++) {
+    is_prime[i] = 1;
+  }
+  int64_t count = 0;
+  for (uint64_t i = 2; i < n; i++) {
+    if (is_prime[i]) {
+      count++;
+      for (uint64_t j = i; j < n; j += i) {
+        is_prime[j] = 0;
+      }
+    }
+  }
+
+  free(is_prime);
+  return count;
+}
+
+static int64_t
+count_v2(uint64_t n)
+{
+  char *prime_map = malloc(n);
+  if (!prime_map) {
+    return -1;
+  }
+
+  memset(prime_map, 1, n);
+  int64_t count = 0;
+  for (uint64_t i = 2; i < n; i++) {
+    if (prime_map[i]) {
+      count++;
+      for (uint64_t j = i; j < n; j += i) {
+        prime_map[j] = 0;
+      }
+    }
+  }
+
+  free(prime_map);
+  return count;
+}
+
+static int64_t
+count_v3(uint64_t n)
+{
+  return sieve_count(0, n - 1);
+}
+
+static int64_t
+count_iterator(uint64_t n)
+{
+  struct sieve_iterator *it = sieve_start(0, n - 1);
+  if (!it) {
+    return -1;
+  }
+
+  int64_t count = 0;
+  while (sieve_next(it)) {
+    count++;
+  }
+
+  sieve_free(it);
+  return count;
+}
+
+static int64_t
+count_lmo(uint64_t n)
+{
+  return lmo_pi(n - 1, 1);
+}
+
+static const struct strategy strategies[] = {
+  {"v1", count_v1, BYTE_MAP_LIMIT},
+  {"v2", count_v2, BYTE_MAP_LIMIT},
+  {"v3", count_v3, UINT64_MAX},
+  {"iterator", count_iterator, UINT64_MAX},
+  {"lmo", count_lmo, UINT64_MAX},
+};
+
+#define STRATEGY_COUNT (sizeof(strategies) / sizeof(strategies[0]))
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs one strategy for n in a child, returning its result and
+// peak RSS in kilobytes, or -1 if the child failed.
+static int
+run(const struct strategy *strategy, uint64_t n, struct result *result,
+    long *rss)
+{
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    struct result r = {0};
+    double start = now();
+    do {
+      r.count = strategy->count(n);
+      r.runs++;
+      r.seconds = now() - start;
+    } while (r.count >= 0 && r.seconds < BENCH_SECONDS);
+    _exit(r.count >= 0 && write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  ssize_t got = read(fds[0], result, sizeof(*result));
+  close(fds[0]);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0 || got != sizeof(*result)) {
+    return -1;
+  }
+
+  *rss = usage.ru_maxrss;
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int max_exponent = argc > 1 ? atoi(argv[1]) : 10;
+  if (max_exponent < 3 || max_exponent > 18) {
+    fprintf(stderr, "Usage: %s [max_exponent] [strategy...]\n", argv[0]);
+    return 1;
+  }
+
+  int chosen[STRATEGY_COUNT] = {0};
+  for (int i = 2; i < argc; i++) {
+    size_t s = 0;
+    while (s < STRATEGY_COUNT && strcmp(argv[i], strategies[s].name) != 0) {
+      s++;
+    }
+    if (s == STRATEGY_COUNT) {
+      fprintf(stderr, "Unknown strategy: %s\n", argv[i]);
+      return 1;
+    }
+    chosen[s] = 1;
+  }
+  for (size_t s = 0; argc <= 2 && s < STRATEGY_COUNT; s++) {
+    chosen[s] = 1;
+  }
+
+  printf("%-9s %6s %12s %10s %10s\n", "strategy", "N", "primes", "ns/number", "peak KB");
+
+  int failed = 0;
+  uint64_t n = 1;
+  for (int e = 1; e <= max_exponent; e++) {
+    n *= 10;
+    if (e < 3) {
+      continue;
+    }
+
+    int64_t expected = -1;
+    for (size_t s = 0; s < STRATEGY_COUNT; s++) {
+      if (!chosen[s]) {
+        continue;
+      }
+      if (n > strategies[s].limit) {
+        printf("%-9s %4s%-2d %12s\n", strategies[s].name, "10^", e, "skipped");
+        continue;
+      }
+
+      struct result result;
+      long rss;
+      if (run(&strategies[s], n, &result, &rss) < 0) {
+        printf("%-9s %4s%-2d %12s\n", strategies[s].name, "10^", e, "failed");
+        failed = 1;
+        continue;
+      }
+
+      printf("%-9s %4s%-2d %12lld %10.3f %10ld\n", strategies[s].name, "10^", e,
+             (long long)result.count, result.seconds * 1e9 / result.runs / n, rss);
+      fflush(stdout);
+
+      if (expected < 0) {
+        expected = result.count;
+      } else if (result.count != expected) {
+        fprintf(stderr, "%s counts %lld primes below 10^%d, not %lld\n",
+                strategies[s].name, (long long)result.count, e, (long long)expected);
+        failed = 1;
+      }
+    }
+  }
+
+  return failed;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Cross-checks --lmo against the sieve's --count for a spread of
+# small max, including the edges around the method's cut-overs.
+#
+# usage: check-lmo.sh [threads]
+
+threads=${1:-2}
+
+cd "$(dirname "$0")"
+gcc sieve.c libsieve.c lmo.c -O2 -g -pthread -lm -o sieve || exit 1
+
+failed=0
+for max in 1 2 3 99 100 101 102 1000 4096 65537 100000 999983 1000000 \
+           12345678 100000000 1000000000 2147483648 10000000000; do
+  count=$(./sieve -j $threads --count $max)
+  lmo=$(./sieve -j $threads --lmo $max)
+  if [ "$count" != "$lmo" ]; then
+    echo "pi below $max: sieve $count, lmo $lmo"
+    failed=1
+  fi
+done
+
+[ $failed = 0 ] && echo "lmo agrees with the sieve"
+exit $failed
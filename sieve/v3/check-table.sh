@@ -0,0 +1,58 @@
+#!/bin/bash
+# Writes prime tables of a few sizes, including ones that end on
+# and just past a rank block, and checks lookups in them against
+# the sieve's own output.
+#
+# usage: check-table.sh [threads]
+
+threads=${1:-2}
+table=$(mktemp)
+trap 'rm -f "$table"' EXIT
+
+cd "$(dirname "$0")"
+gcc sieve.c libsieve.c lmo.c -O2 -g -pthread -lm -o sieve || exit 1
+gcc lookup.c table.c -O2 -g -o lookup || exit 1
+
+failed=0
+for max in 1 2 3 6 7 8 30 31 122880 122881 122911 1000000 10000000; do
+  ./sieve -j $threads --table "$table" $max || exit 1
+  hi=$((max - 1))
+
+  # Every prime's rank, and a spread of n around and between them.
+  primes=$(./sieve $max | tr '\n' ' ')
+  ns="0 $hi $((hi / 2)) $((hi / 3)) $((hi / 7 * 6))"
+  for n in $ns; do
+    [ $n -gt $hi ] && continue
+    pi=$(./lookup "$table" pi $n)
+    count=$(./sieve --count $((n + 1)))
+    if [ "$pi" != "$count" ]; then
+      echo "max $max: pi($n) is $pi, sieve says $count"
+      failed=1
+    fi
+  done
+
+  if [ -n "$primes" ]; then
+    count=$(echo $primes | wc -w)
+    ks="1 $count $((count / 2 + 1)) $((count / 3 + 1))"
+    for k in $ks; do
+      nth=$(./lookup "$table" nth $k)
+      expected=$(echo $primes | cut -d' ' -f$k)
+      if [ "$nth" != "$expected" ]; then
+        echo "max $max: prime $k is $nth, sieve says $expected"
+        failed=1
+      fi
+    done
+  fi
+
+  if [ $max -le 1000000 ]; then
+    tested=$(./lookup "$table" is-prime $(seq 0 $((hi < 2000 ? hi : 2000))) | grep -c 1)
+    count=$(./sieve --count $((hi < 2000 ? max : 2001)))
+    if [ "$tested" != "$count" ]; then
+      echo "max $max: $tested primes by is-prime, sieve says $count"
+      failed=1
+    fi
+  fi
+done
+
+[ $failed = 0 ] && echo "tables agree with the sieve"
+exit $failed
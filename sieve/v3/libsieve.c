@@ -0,0 +1,587 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "libsieve.h"
+#include "wheel.h"
+
+// The segmented wheel, which sieve.c runs on as well, and the
+// iterator over it: sieve_next takes the primes out of a segment
+// word by word and sieves the following segment when it runs dry.
+
+struct sieve_iterator {
+  uint64_t lo;         // the range, hi included
+  uint64_t hi;
+  uint64_t low;        // the bytes in the segment
+  uint64_t high;
+  struct base base;
+  struct span span;
+  int small;           // how many of 2, 3 and 5 are done
+  size_t word;         // the next word of the segment to scan
+  size_t words;
+  uint64_t bits;       // what is left of the word before it
+  uint64_t segment[SEGMENT_BYTES / 8];
+};
+
+const uint8_t wheel[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+static const uint8_t wheel_gap[8] = {6, 4, 2, 4, 2, 4, 6, 2};
+static const uint64_t small_primes[] = {2, 3, 5};
+
+// The bit of each residue mod 30 in a byte, or 0xff for those
+// that share a factor with 30.
+static uint8_t wheel_bit[30];
+
+// Striking the multiples p * m of a prime p = 30a + wheel[r] with
+// m prime to 30: at m = 30k + wheel[i], the multiple is bit
+// wheel_mask[r][i] of byte (30a + wheel[r]) * m / 30, and the next
+// one is a * wheel_gap[i] + wheel_carry[r][i] bytes further on.
+static uint8_t wheel_mask[8][8];
+static uint8_t wheel_carry[8][8];
+
+uint16_t wheel_sum[256];
+
+uint64_t (*popcount)(const uint64_t *words, size_t count);
+
+// Every bit set but those of the multiples of 7, 11 and 13,
+// including those primes themselves.
+static uint8_t tile[TILE_BYTES + SEGMENT_BYTES];
+
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+static uint64_t
+popcount_scalar(const uint64_t *words, size_t count)
+{
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += __builtin_popcountll(words[i]);
+  }
+  return total;
+}
+
+__attribute__((target("popcnt")))
+static uint64_t
+popcount_popcnt(const uint64_t *words, size_t count)
+{
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += __builtin_popcountll(words[i]);
+  }
+  return total;
+}
+
+// Looks up each nibble's bit count with a byte shuffle, and sums
+// the bytes of each 64-bit lane with a SAD against zero.
+__attribute__((target("avx2,popcnt")))
+static uint64_t
+popcount_avx2(const uint64_t *words, size_t count)
+{
+  const __m256i nibbles = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i totals = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+    __m256i bits = _mm256_add_epi8(
+      _mm256_shuffle_epi8(nibbles, _mm256_and_si256(v, low)),
+      _mm256_shuffle_epi8(nibbles, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    totals = _mm256_add_epi64(totals, _mm256_sad_epu8(bits, _mm256_setzero_si256()));
+  }
+
+  uint64_t total = _mm256_extract_epi64(totals, 0) + _mm256_extract_epi64(totals, 1) +
+                   _mm256_extract_epi64(totals, 2) + _mm256_extract_epi64(totals, 3);
+  for (; i < count; i++) {
+    total += __builtin_popcountll(words[i]);
+  }
+  return total;
+}
+
+static void
+init_tables(void)
+{
+  memset(wheel_bit, 0xff, sizeof(wheel_bit));
+  for (int i = 0; i < 8; i++) {
+    wheel_bit[wheel[i]] = i;
+  }
+
+  for (int r = 0; r < 8; r++) {
+    for (int i = 0; i < 8; i++) {
+      unsigned m = wheel[i];
+      unsigned next = m + wheel_gap[i];
+      wheel_mask[r][i] = ~(1 << wheel_bit[wheel[r] * m % 30]);
+      wheel_carry[r][i] = wheel[r] * next / 30 - wheel[r] * m / 30;
+    }
+  }
+
+  for (int byte = 0; byte < 256; byte++) {
+    wheel_sum[byte] = 0;
+    for (int i = 0; i < 8; i++) {
+      if (byte & (1 << i)) {
+        wheel_sum[byte] += wheel[i];
+      }
+    }
+  }
+
+  memset(tile, 0xff, sizeof(tile));
+  for (uint64_t p = 7; p <= 13; p += p == 7 ? 4 : 2) {
+    for (uint64_t n = p; n < 30 * sizeof(tile); n += 2 * p) {
+      if (wheel_bit[n % 30] != 0xff) {
+        tile[n / 30] &= ~(1 << wheel_bit[n % 30]);
+      }
+    }
+  }
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    popcount = popcount_avx2;
+  } else if (__builtin_cpu_supports("popcnt")) {
+    popcount = popcount_popcnt;
+  } else {
+    popcount = popcount_scalar;
+  }
+}
+
+void
+wheel_init(void)
+{
+  pthread_once(&wheel_once, init_tables);
+}
+
+static uint64_t
+isqrt(uint64_t n)
+{
+  uint64_t r = 0;
+  for (uint64_t bit = (uint64_t)1 << 62; bit; bit >>= 2) {
+    if (n >= r + bit) {
+      n -= r + bit;
+      r = (r >> 1) + bit;
+    } else {
+      r >>= 1;
+    }
+  }
+  return r;
+}
+
+// The primes up to hi^(1/4) sieve the rest one segment of odd
+// numbers at a time, so beyond the list itself this needs only
+// O(hi^(1/4)) bytes. The list is sized by Rosser's bound,
+// pi(n) < 1.25506 n / ln n, with ln n rounded down to a multiple of
+// ln 2, so it never has to grow.
+uint32_t *
+find_base_primes(uint64_t hi, size_t *count)
+{
+  uint64_t limit = isqrt(hi);
+  uint64_t root = isqrt(limit);
+
+  char *composite = calloc(root + 1, 1);
+  uint8_t *segment = malloc(SEGMENT_BYTES);
+  size_t capacity = 1024;
+  if (limit >= 1024) {
+    int log2 = 63 - __builtin_clzll(limit);
+    capacity = limit * 1.25506 / (log2 * 0.693147) + 32;
+  }
+  uint32_t *primes = malloc(sizeof(*primes) * capacity);
+  if (!composite || !segment || !primes) {
+    goto fail;
+  }
+
+  for (uint64_t i = 3; i * i <= root; i += 2) {
+    if (!composite[i]) {
+      for (uint64_t j = i * i; j <= root; j += 2 * i) {
+        composite[j] = 1;
+      }
+    }
+  }
+
+  // Byte k of a segment is low + 2k + 1.
+  size_t n = 0;
+  for (uint64_t low = 0; low <= limit; low += 2 * SEGMENT_BYTES) {
+    uint64_t high = low + 2 * SEGMENT_BYTES < limit + 1 ? low + 2 * SEGMENT_BYTES : limit + 1;
+    memset(segment, 1, SEGMENT_BYTES);
+
+    for (uint64_t q = 3; q <= root && q * q < high; q += 2) {
+      if (composite[q]) {
+        continue;
+      }
+      uint64_t m = q * q > low ? q * q : (low + q - 1) / q * q;
+      if (m % 2 == 0) {
+        m += q;
+      }
+      for (; m < high; m += 2 * q) {
+        segment[(m - low) / 2] = 0;
+      }
+    }
+
+    for (uint64_t k = 0; low + 2 * k + 1 < high; k++) {
+      uint64_t p = low + 2 * k + 1;
+      if (!segment[k] || p <= 13) {
+        continue;
+      }
+      if (n == capacity) {
+        capacity *= 2;
+        uint32_t *grown = realloc(primes, sizeof(*primes) * capacity);
+        if (!grown) {
+          goto fail;
+        }
+        primes = grown;
+      }
+      primes[n++] = p;
+    }
+  }
+
+  free(segment);
+  free(composite);
+  *count = n;
+  return primes;
+
+fail:
+  free(primes);
+  free(segment);
+  free(composite);
+  return NULL;
+}
+
+int
+base_init(struct base *base, uint64_t lo, uint64_t hi)
+{
+  base->first = lo / 30;
+  base->end = lo <= hi ? hi / 30 + 1 : base->first;
+  base->large = 0;
+  base->primes = find_base_primes(hi, &base->count);
+  if (!base->primes) {
+    return -1;
+  }
+
+  while (base->large < base->count && base->primes[base->large] / 30 < BUCKET_BYTES) {
+    base->large++;
+  }
+
+  // A large prime p steps at most 6 * (p / 30) + 6 bytes at a time,
+  // which the ring of buckets must reach past the segment it is in.
+  uint64_t step = base->count > 0 ? 6 * (base->primes[base->count - 1] / 30) + 6 : 0;
+  base->bucket_count = step / SEGMENT_BYTES + 2;
+  return 0;
+}
+
+void
+base_free(struct base *base)
+{
+  free(base->primes);
+}
+
+// The first multiple p * m worth striking at or after byte low,
+// with m prime to 30 and never below p, as its byte shifted left
+// by 3 above the wheel position of m.
+static uint64_t
+first_multiple(uint64_t p, uint64_t low)
+{
+  // 30 * low and p * m can pass 2^64 near the top of the range.
+  uint64_t m = ((unsigned __int128)30 * low + p - 1) / p;
+  if (m < p) {
+    m = p;
+  }
+  while (wheel_bit[m % 30] == 0xff) {
+    m++;
+  }
+  return (uint64_t)((unsigned __int128)p * m / 30) << 3 | wheel_bit[m % 30];
+}
+
+int
+span_init(struct span *span, const struct base *base)
+{
+  span->base = base;
+  span->end = base->first;
+  span->small_started = 0;
+  span->large_started = base->large;
+  span->next = malloc(sizeof(*span->next) * (base->large + 1));
+  span->buckets = calloc(base->bucket_count, sizeof(*span->buckets));
+  if (!span->next || !span->buckets) {
+    span_free(span);
+    return -1;
+  }
+  return 0;
+}
+
+// Every prime starts over, at its square or in the span's first
+// segment, whichever comes later.
+void
+span_start(struct span *span, uint64_t end)
+{
+  span->end = end < span->base->end ? end : span->base->end;
+  span->small_started = 0;
+  span->large_started = span->base->large;
+  for (size_t i = 0; i < span->base->bucket_count; i++) {
+    span->buckets[i].length = 0;
+  }
+}
+
+void
+span_free(struct span *span)
+{
+  for (size_t i = 0; span->buckets && i < span->base->bucket_count; i++) {
+    free(span->buckets[i].entries);
+  }
+  free(span->buckets);
+  free(span->next);
+  span->buckets = NULL;
+  span->next = NULL;
+}
+
+static int
+add_to_bucket(struct bucket *bucket, uint64_t entry)
+{
+  if (bucket->length == bucket->capacity) {
+    size_t capacity = bucket->capacity ? bucket->capacity * 2 : 1024;
+    uint64_t *entries = realloc(bucket->entries, sizeof(*entries) * capacity);
+    if (!entries) {
+      return -1;
+    }
+    bucket->entries = entries;
+    bucket->capacity = capacity;
+  }
+
+  bucket->entries[bucket->length++] = entry;
+  return 0;
+}
+
+// Files large prime i under the segment of its next multiple m,
+// unless that is past the span.
+static int
+file_large(struct span *span, size_t i, uint64_t m)
+{
+  const struct base *base = span->base;
+  uint64_t byte = m >> 3;
+  if (byte >= span->end) {
+    return 0;
+  }
+
+  uint64_t segment = (byte - base->first) / SEGMENT_BYTES;
+  uint64_t offset = (byte - base->first) % SEGMENT_BYTES;
+  return add_to_bucket(&span->buckets[segment % base->bucket_count],
+                       (uint64_t)i << 32 | offset << 3 | (m & 7));
+}
+
+// The small primes are struck each in turn, and the large ones from
+// the segment's bucket. Each prime is left at its next multiple, for
+// the following segment.
+int
+sieve_segment(struct span *span, uint64_t *segment, uint64_t low, uint64_t high)
+{
+  const struct base *base = span->base;
+  uint8_t *bytes = (uint8_t *)segment;
+
+  memcpy(bytes, tile + low % TILE_BYTES, SEGMENT_BYTES);
+  if (low == 0) {
+    bytes[0] &= ~1;    // 1 is not prime
+    bytes[0] |= 0x0e;  // but 7, 11 and 13 are
+  }
+
+  // Primes come in increasing order, and none strikes anything
+  // below its square.
+  for (; span->small_started < base->large; span->small_started++) {
+    uint64_t p = base->primes[span->small_started];
+    if (p * p / 30 >= high) {
+      break;
+    }
+    span->next[span->small_started] = first_multiple(p, low);
+  }
+  for (; span->large_started < base->count; span->large_started++) {
+    uint64_t p = base->primes[span->large_started];
+    if (p * p / 30 >= high) {
+      break;
+    }
+    if (file_large(span, span->large_started, first_multiple(p, low)) < 0) {
+      return -1;
+    }
+  }
+
+  for (size_t i = 0; i < span->small_started; i++) {
+    uint64_t p = base->primes[i];
+    uint64_t a = p / 30;
+    const uint8_t *mask = wheel_mask[wheel_bit[p % 30]];
+    const uint8_t *carry = wheel_carry[wheel_bit[p % 30]];
+    uint64_t byte = span->next[i] >> 3;
+    unsigned w = span->next[i] & 7;
+
+    while (byte < high) {
+      bytes[byte - low] &= mask[w];
+      byte += a * wheel_gap[w] + carry[w];
+      w = (w + 1) & 7;
+    }
+    span->next[i] = byte << 3 | w;
+  }
+
+  // A large prime steps further than one segment, so its multiple
+  // in this one is its last here, and it moves to a later bucket.
+  struct bucket *bucket =
+    &span->buckets[(low - base->first) / SEGMENT_BYTES % base->bucket_count];
+  for (size_t j = 0; j < bucket->length; j++) {
+    uint64_t entry = bucket->entries[j];
+    size_t i = entry >> 32;
+    uint64_t p = base->primes[i];
+    uint64_t a = p / 30;
+    const uint8_t *mask = wheel_mask[wheel_bit[p % 30]];
+    const uint8_t *carry = wheel_carry[wheel_bit[p % 30]];
+    uint64_t byte = low + ((uint32_t)entry >> 3);
+    unsigned w = entry & 7;
+
+    do {
+      bytes[byte - low] &= mask[w];
+      byte += a * wheel_gap[w] + carry[w];
+      w = (w + 1) & 7;
+    } while (byte < high);
+
+    if (file_large(span, i, byte << 3 | w) < 0) {
+      return -1;
+    }
+  }
+
+  bucket->length = 0;
+  return 0;
+}
+
+void
+clear_head(uint64_t *segment, uint64_t lo)
+{
+  uint8_t *bytes = (uint8_t *)segment;
+  for (int i = 0; i < 8; i++) {
+    if (wheel[i] < lo % 30) {
+      bytes[0] &= ~(1 << i);
+    }
+  }
+}
+
+void
+clear_tail(uint64_t *segment, uint64_t low, uint64_t hi)
+{
+  uint8_t *bytes = (uint8_t *)segment;
+  uint64_t k = hi / 30 - low;
+  for (int i = 0; i < 8; i++) {
+    if (wheel[i] > hi % 30) {
+      bytes[k] &= ~(1 << i);
+    }
+  }
+  memset(bytes + k + 1, 0, SEGMENT_BYTES - k - 1);
+}
+
+// Sieves the segment after the current one, clearing the numbers
+// outside the range at either end. Returns 0 once past hi, and -1
+// if memory runs out.
+static int
+advance(struct sieve_iterator *it)
+{
+  if (it->high >= it->base.end) {
+    return 0;
+  }
+
+  uint64_t low = it->high;
+  uint64_t high = low + SEGMENT_BYTES < it->base.end ? low + SEGMENT_BYTES : it->base.end;
+  if (sieve_segment(&it->span, it->segment, low, high) < 0) {
+    return -1;
+  }
+  if (low == it->base.first) {
+    clear_head(it->segment, it->lo);
+  }
+  if (high == it->base.end) {
+    clear_tail(it->segment, low, it->hi);
+  }
+
+  it->low = low;
+  it->high = high;
+  it->word = 0;
+  it->words = (high - low + 7) / 8;
+  it->bits = 0;
+  return 1;
+}
+
+struct sieve_iterator *
+sieve_start(uint64_t lo, uint64_t hi)
+{
+  wheel_init();
+
+  struct sieve_iterator *it = malloc(sizeof(*it));
+  if (!it) {
+    return NULL;
+  }
+  if (base_init(&it->base, lo, hi) < 0) {
+    free(it);
+    return NULL;
+  }
+  if (span_init(&it->span, &it->base) < 0) {
+    base_free(&it->base);
+    free(it);
+    return NULL;
+  }
+
+  // The whole range is one span.
+  span_start(&it->span, it->base.end);
+  it->lo = lo;
+  it->hi = hi;
+  it->low = it->base.first;
+  it->high = it->base.first;
+  it->small = 0;
+  it->word = 0;
+  it->words = 0;
+  it->bits = 0;
+  return it;
+}
+
+uint64_t
+sieve_next(struct sieve_iterator *it)
+{
+  // The wheel leaves out 2, 3 and 5.
+  while (it->small < 3) {
+    uint64_t p = small_primes[it->small++];
+    if (p >= it->lo && p <= it->hi) {
+      return p;
+    }
+  }
+
+  while (it->bits == 0) {
+    if (it->word < it->words) {
+      it->bits = it->segment[it->word++];
+    } else if (advance(it) <= 0) {
+      return 0;
+    }
+  }
+
+  unsigned b = __builtin_ctzll(it->bits);
+  it->bits &= it->bits - 1;
+  return 30 * (it->low + (it->word - 1) * 8 + b / 8) + wheel[b % 8];
+}
+
+void
+sieve_free(struct sieve_iterator *it)
+{
+  if (it) {
+    span_free(&it->span);
+    base_free(&it->base);
+    free(it);
+  }
+}
+
+int64_t
+sieve_count(uint64_t lo, uint64_t hi)
+{
+  struct sieve_iterator *it = sieve_start(lo, hi);
+  if (!it) {
+    return -1;
+  }
+
+  int64_t count = 0;
+  for (int i = 0; i < 3; i++) {
+    count += small_primes[i] >= lo && small_primes[i] <= hi;
+  }
+
+  int result;
+  while ((result = advance(it)) > 0) {
+    count += popcount(it->segment, it->words);
+  }
+
+  sieve_free(it);
+  return result < 0 ? -1 : count;
+}
@@ -0,0 +1,24 @@
+#include <stdint.h>
+
+// The v3 sieve as a library: the mod 30 wheel, sieved one L1-sized
+// segment at a time on the calling thread by the same engine as
+// sieve.c. Memory is one segment plus the base primes up to
+// sqrt(hi), with a next multiple or bucket entry for each of them,
+// whatever the range.
+
+struct sieve_iterator;
+
+// Starts an iterator over the primes from lo to hi, both included.
+// Returns NULL if memory runs out.
+struct sieve_iterator *sieve_start(uint64_t lo, uint64_t hi);
+
+// The next prime, in increasing order, or 0 once they run out or
+// memory does.
+uint64_t sieve_next(struct sieve_iterator *it);
+
+void sieve_free(struct sieve_iterator *it);
+
+// Counts the primes from lo to hi, a segment at a time with
+// popcount rather than prime by prime. Returns -1 if memory runs
+// out.
+int64_t sieve_count(uint64_t lo, uint64_t hi);
@@ -0,0 +1,605 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "lmo.h"
+#include "wheel.h"
+
+// Prime counting after Lagarias, Miller and Odlyzko. With
+// y = alpha * x^(1/3) and a = pi(y),
+//
+//   pi(x) = phi(x, a) + a - 1 - P2(x, a)
+//
+// where phi(x, a) counts the numbers up to x with no prime factor
+// among the first a primes, and P2(x, a) those with exactly two
+// prime factors above p_a. phi(x, a) splits into the ordinary
+// leaves S1, one term for each squarefree n <= y, and the special
+// leaves S2, the terms phi(x / n, b) with y < n. The special leaves
+// are counted by sieving [1, x / y) in segments with a Fenwick tree
+// over each one, and P2 by sieving up to x / y as well. Both sieves
+// are split into chunks that the threads take from a queue, and the
+// chunks' partial counts are put together in order afterwards.
+
+// Chunks per thread, so that uneven chunks still balance.
+#define CHUNKS_PER_THREAD 8
+
+// P2 sieves odd numbers only, one byte each.
+#define P2_SEGMENT (256 * 1024)
+
+struct s2_chunk {
+  int64_t sum;     // the leaves, with phi counted from the chunk's start
+  int64_t *phi;    // numbers left in the chunk for each b
+  int64_t *leaves; // sum of the leaves' signs for each b
+};
+
+struct p2_chunk {
+  int64_t primes;  // primes in the chunk
+  int64_t sum;     // pi(x / p) counted from the chunk's start
+  int64_t hits;    // how many x / p fell in the chunk
+};
+
+struct lmo {
+  int64_t x;
+  int64_t y;
+  int64_t z;             // x / y
+  int64_t sqrtx;
+
+  uint32_t *primes;      // primes[1..] up to sqrt(x), primes[0] = 0
+  int64_t prime_count;
+  int64_t pi_y;
+  int64_t pi_sqrty;
+  int64_t pi_sqrtx;
+  int32_t *lpf;          // least prime factor, for n <= y
+  int8_t *mu;            // Moebius function, for n <= y
+  int32_t *pi;           // pi(n), for n <= y
+
+  int64_t segment_size;  // for S2
+
+  // The work queue of chunks, over [first, limit).
+  pthread_mutex_t lock;
+  int64_t first;
+  int64_t limit;
+  int64_t chunk_size;
+  int64_t chunk_count;
+  int64_t next_chunk;
+  int failed;
+  struct s2_chunk *s2;
+  int64_t s2_count;
+  struct p2_chunk *p2;
+};
+
+static int64_t
+isqrt64(int64_t n)
+{
+  int64_t r = sqrtl(n);
+  while (r * r > n) {
+    r--;
+  }
+  while ((r + 1) * (r + 1) <= n) {
+    r++;
+  }
+  return r;
+}
+
+static int64_t
+icbrt64(int64_t n)
+{
+  int64_t r = cbrtl(n);
+  while (r * r * r > n) {
+    r--;
+  }
+  while ((r + 1) * (r + 1) * (r + 1) <= n) {
+    r++;
+  }
+  return r;
+}
+
+static int64_t
+min64(int64_t a, int64_t b)
+{
+  return a < b ? a : b;
+}
+
+static int64_t
+max64(int64_t a, int64_t b)
+{
+  return a > b ? a : b;
+}
+
+// Fills in the least prime factors, Moebius function and pi up to
+// y, and the primes up to sqrt(x). Those come from libsieve's
+// segmented base-prime sieve, which sizes its table by a bound on
+// pi, so near 2^63, where sqrt(x) is about 3 * 10^9, the table is
+// some 590 MB and the sieve itself a few KB.
+static int
+init_tables(struct lmo *lmo)
+{
+  static const uint32_t small[] = {2, 3, 5, 7, 11, 13};
+  int64_t y = lmo->y;
+
+  lmo->lpf = calloc(y + 1, sizeof(*lmo->lpf));
+  lmo->mu = malloc(y + 1);
+  lmo->pi = malloc(sizeof(*lmo->pi) * (y + 1));
+  if (!lmo->lpf || !lmo->mu || !lmo->pi) {
+    return -1;
+  }
+
+  // y <= sqrt(x), so the primes with p * p <= x cover both. The
+  // sieve leaves out those up to 13, which go in front of the rest
+  // with primes[0] = 0.
+  size_t count;
+  uint32_t *found = find_base_primes(lmo->x, &count);
+  if (!found) {
+    return -1;
+  }
+  size_t head = 1;
+  while (head <= 6 && small[head - 1] <= lmo->sqrtx) {
+    head++;
+  }
+  lmo->primes = realloc(found, sizeof(*found) * (head + count));
+  if (!lmo->primes) {
+    free(found);
+    return -1;
+  }
+  memmove(lmo->primes + head, lmo->primes, sizeof(*lmo->primes) * count);
+  lmo->primes[0] = 0;
+  memcpy(lmo->primes + 1, small, sizeof(*small) * (head - 1));
+  lmo->prime_count = head - 1 + count;
+
+  for (int64_t i = 1; i <= lmo->prime_count && lmo->primes[i] <= y; i++) {
+    int64_t p = lmo->primes[i];
+    for (int64_t j = p; j <= y; j += p) {
+      if (!lmo->lpf[j]) {
+        lmo->lpf[j] = p;
+      }
+    }
+  }
+
+  // lpf(1) is taken as infinite: every prime lies below it.
+  lmo->lpf[1] = INT32_MAX;
+  lmo->mu[1] = 1;
+  lmo->pi[0] = 0;
+  lmo->pi[1] = 0;
+  for (int64_t n = 2; n <= y; n++) {
+    int64_t p = lmo->lpf[n];
+    int64_t m = n / p;
+    lmo->mu[n] = m % p == 0 ? 0 : -lmo->mu[m];
+    lmo->pi[n] = lmo->pi[n - 1] + (lmo->lpf[n] == n);
+  }
+
+  lmo->pi_y = lmo->pi[y];
+  lmo->pi_sqrty = lmo->pi[isqrt64(y)];
+  lmo->pi_sqrtx = 0;
+  while (lmo->pi_sqrtx < lmo->prime_count &&
+         lmo->primes[lmo->pi_sqrtx + 1] <= lmo->sqrtx) {
+    lmo->pi_sqrtx++;
+  }
+  return 0;
+}
+
+// The ordinary leaves: mu(n) * phi(x / n, 0) for n <= y.
+static int64_t
+s1(const struct lmo *lmo)
+{
+  int64_t sum = 0;
+  for (int64_t n = 1; n <= lmo->y; n++) {
+    sum += lmo->mu[n] * (lmo->x / n);
+  }
+  return sum;
+}
+
+// A Fenwick tree over a segment, counting the numbers not yet
+// struck at or before each position.
+static void
+tree_fill(int32_t *tree, int64_t size)
+{
+  for (int64_t i = 0; i < size; i++) {
+    tree[i] = i - (i & (i + 1)) + 1;
+  }
+}
+
+static void
+tree_remove(int32_t *tree, int64_t size, int64_t i)
+{
+  for (; i < size; i |= i + 1) {
+    tree[i]--;
+  }
+}
+
+static int64_t
+tree_count(const int32_t *tree, int64_t i)
+{
+  int64_t count = 0;
+  for (; i >= 0; i = (i & (i + 1)) - 1) {
+    count += tree[i];
+  }
+  return count;
+}
+
+static int64_t
+first_multiple(int64_t p, int64_t low)
+{
+  int64_t m = (low + p - 1) / p * p;
+  if (p != 2 && m % 2 == 0) {
+    m += p;
+  }
+  return m;
+}
+
+// Strikes the multiples of p in [low, high) from the segment and
+// the tree. Odd primes skip the even multiples, which 2 struck.
+static void
+cross_off(int64_t p, int64_t low, int64_t high, int64_t *next,
+          uint8_t *sieve, int32_t *tree)
+{
+  int64_t step = p == 2 ? 2 : 2 * p;
+  int64_t m = *next;
+  for (; m < high; m += step) {
+    if (sieve[m - low]) {
+      sieve[m - low] = 0;
+      tree_remove(tree, high - low, m - low);
+    }
+  }
+  *next = m;
+}
+
+// Finds the special leaves phi(x / n, b - 1) with x / n in the
+// chunk [start, end), for n = p_b * m.
+static void
+s2_chunk(const struct lmo *lmo, int64_t start, int64_t end,
+         struct s2_chunk *chunk, uint8_t *sieve, int32_t *tree,
+         int64_t *next)
+{
+  int64_t x = lmo->x;
+  int64_t y = lmo->y;
+  const uint32_t *primes = lmo->primes;
+
+  for (int64_t b = 1; b < lmo->pi_y; b++) {
+    next[b] = first_multiple(primes[b], start);
+  }
+
+  for (int64_t low = start; low < end; low += lmo->segment_size) {
+    int64_t high = min64(low + lmo->segment_size, end);
+    int64_t size = high - low;
+    memset(sieve, 1, size);
+    tree_fill(tree, size);
+
+    // Below sqrt(y), m is any squarefree number with no prime
+    // factor up to p_b.
+    int64_t b = 1;
+    for (; b < lmo->pi_sqrty; b++) {
+      int64_t p = primes[b];
+      int64_t min_m = max64(x / (p * high), y / p);
+      int64_t max_m = min64(x / (p * low), y);
+      if (p >= max_m) {
+        goto next_segment;
+      }
+
+      for (int64_t m = max_m; m > min_m; m--) {
+        if (lmo->mu[m] != 0 && p < lmo->lpf[m]) {
+          int64_t count = tree_count(tree, x / (p * m) - low);
+          chunk->sum -= lmo->mu[m] * (chunk->phi[b] + count);
+          chunk->leaves[b] -= lmo->mu[m];
+        }
+      }
+
+      chunk->phi[b] += tree_count(tree, size - 1);
+      cross_off(p, low, high, &next[b], sieve, tree);
+    }
+
+    // Above sqrt(y), m must be a prime above p_b.
+    for (; b < lmo->pi_y; b++) {
+      int64_t p = primes[b];
+      int64_t l = lmo->pi[min64(x / (p * low), y)];
+      int64_t min_m = max64(max64(x / (p * high), y / p), p);
+      if (p >= primes[l]) {
+        goto next_segment;
+      }
+
+      for (; primes[l] > min_m; l--) {
+        int64_t count = tree_count(tree, x / (p * primes[l]) - low);
+        chunk->sum += chunk->phi[b] + count;
+        chunk->leaves[b]++;
+      }
+
+      chunk->phi[b] += tree_count(tree, size - 1);
+      cross_off(p, low, high, &next[b], sieve, tree);
+    }
+
+  next_segment:;
+  }
+}
+
+static void *
+s2_worker(void *arg)
+{
+  struct lmo *lmo = arg;
+  uint8_t *sieve = malloc(lmo->segment_size);
+  int32_t *tree = malloc(sizeof(*tree) * lmo->segment_size);
+  int64_t *next = malloc(sizeof(*next) * (lmo->pi_y + 1));
+
+  pthread_mutex_lock(&lmo->lock);
+  if (!sieve || !tree || !next) {
+    lmo->failed = 1;
+  }
+
+  while (!lmo->failed && lmo->next_chunk < lmo->chunk_count) {
+    int64_t i = lmo->next_chunk++;
+    pthread_mutex_unlock(&lmo->lock);
+
+    int64_t start = lmo->first + i * lmo->chunk_size;
+    int64_t end = min64(start + lmo->chunk_size, lmo->limit);
+    s2_chunk(lmo, start, end, &lmo->s2[i], sieve, tree, next);
+
+    pthread_mutex_lock(&lmo->lock);
+  }
+
+  pthread_mutex_unlock(&lmo->lock);
+
+  free(next);
+  free(tree);
+  free(sieve);
+  return NULL;
+}
+
+// Counts the primes in the chunk [start, end), and for each prime
+// y < p <= sqrt(x) with x / p in the chunk, the primes from start
+// up to x / p.
+static void
+p2_chunk(const struct lmo *lmo, int64_t start, int64_t end,
+         struct p2_chunk *chunk, uint8_t *sieve)
+{
+  int64_t x = lmo->x;
+  const uint32_t *primes = lmo->primes;
+
+  // The primes p with x / p in the chunk, largest first.
+  int64_t i = lmo->pi_sqrtx;
+  while (i > lmo->pi_y && x / primes[i] < start) {
+    i--;
+  }
+
+  int64_t count = start <= 2 && 2 < end ? 1 : 0;
+
+  // Segments start on even numbers: byte k is low + 2k + 1.
+  for (int64_t low = start; low < end; low += P2_SEGMENT) {
+    int64_t high = min64(low + P2_SEGMENT, end);
+    int64_t size = (high - low) / 2;
+    memset(sieve, 1, size);
+    if (low == 0) {
+      sieve[0] = 0;  // 1 is not prime
+    }
+
+    for (int64_t j = 2; j <= lmo->prime_count; j++) {
+      int64_t q = primes[j];
+      if (q * q >= high) {
+        break;
+      }
+      int64_t m = max64(q * q, (low + q - 1) / q * q);
+      if (m % 2 == 0) {
+        m += q;
+      }
+      for (; m < high; m += 2 * q) {
+        sieve[(m - low) / 2] = 0;
+      }
+    }
+
+    int64_t k = 0;
+    for (; i > lmo->pi_y && x / primes[i] < high; i--) {
+      int64_t v = x / primes[i];
+      for (; k < size && low + 2 * k + 1 <= v; k++) {
+        count += sieve[k];
+      }
+      chunk->sum += count;
+      chunk->hits++;
+    }
+    for (; k < size; k++) {
+      count += sieve[k];
+    }
+  }
+
+  chunk->primes = count;
+}
+
+static void *
+p2_worker(void *arg)
+{
+  struct lmo *lmo = arg;
+  uint8_t *sieve = malloc(P2_SEGMENT / 2);
+
+  pthread_mutex_lock(&lmo->lock);
+  if (!sieve) {
+    lmo->failed = 1;
+  }
+
+  while (!lmo->failed && lmo->next_chunk < lmo->chunk_count) {
+    int64_t i = lmo->next_chunk++;
+    pthread_mutex_unlock(&lmo->lock);
+
+    int64_t start = lmo->first + i * lmo->chunk_size;
+    int64_t end = min64(start + lmo->chunk_size, lmo->limit);
+    p2_chunk(lmo, start, end, &lmo->p2[i], sieve);
+
+    pthread_mutex_lock(&lmo->lock);
+  }
+
+  pthread_mutex_unlock(&lmo->lock);
+
+  free(sieve);
+  return NULL;
+}
+
+// Splits [first, limit) into chunks of whole segments and runs the
+// worker on them. The calling thread works too, so this still
+// finishes when no thread can be started.
+static int
+run_chunks(struct lmo *lmo, int64_t first, int64_t limit, int64_t segment,
+           void *(*worker)(void *), int threads)
+{
+  int64_t chunks = (int64_t)threads * CHUNKS_PER_THREAD;
+  int64_t size = (limit - first + chunks - 1) / chunks;
+  size = max64((size + segment - 1) / segment * segment, segment);
+
+  lmo->first = first;
+  lmo->limit = limit;
+  lmo->chunk_size = size;
+  lmo->chunk_count = (limit - first + size - 1) / size;
+  lmo->next_chunk = 0;
+
+  pthread_t *workers = malloc(sizeof(*workers) * threads);
+  int started = 0;
+  for (; workers && started < threads - 1; started++) {
+    if (pthread_create(&workers[started], NULL, worker, lmo) != 0) {
+      break;
+    }
+  }
+
+  worker(lmo);
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  return lmo->failed ? -1 : 0;
+}
+
+static int
+s2(struct lmo *lmo, int threads, int64_t *result)
+{
+  int64_t chunks = (int64_t)threads * CHUNKS_PER_THREAD;
+  lmo->s2 = calloc(chunks, sizeof(*lmo->s2));
+  if (!lmo->s2) {
+    return -1;
+  }
+  lmo->s2_count = chunks;
+  for (int64_t i = 0; i < chunks; i++) {
+    lmo->s2[i].phi = calloc(lmo->pi_y + 1, sizeof(int64_t));
+    lmo->s2[i].leaves = calloc(lmo->pi_y + 1, sizeof(int64_t));
+    if (!lmo->s2[i].phi || !lmo->s2[i].leaves) {
+      return -1;
+    }
+  }
+
+  if (run_chunks(lmo, 1, lmo->z + 1, lmo->segment_size, s2_worker, threads) < 0) {
+    return -1;
+  }
+
+  // Each chunk counted phi from its own start; add what the chunks
+  // before it left for each b.
+  int64_t *phi = calloc(lmo->pi_y + 1, sizeof(*phi));
+  if (!phi) {
+    return -1;
+  }
+
+  int64_t sum = 0;
+  for (int64_t i = 0; i < lmo->chunk_count; i++) {
+    struct s2_chunk *chunk = &lmo->s2[i];
+    sum += chunk->sum;
+    for (int64_t b = 1; b < lmo->pi_y; b++) {
+      sum += phi[b] * chunk->leaves[b];
+      phi[b] += chunk->phi[b];
+    }
+  }
+
+  free(phi);
+  *result = sum;
+  return 0;
+}
+
+// P2(x, a) = sum over y < p <= sqrt(x) of pi(x / p) - pi(p) + 1.
+static int
+p2(struct lmo *lmo, int threads, int64_t *result)
+{
+  int64_t a = lmo->pi_y;
+  int64_t b = lmo->pi_sqrtx;
+  if (a >= b) {
+    *result = 0;
+    return 0;
+  }
+
+  int64_t chunks = (int64_t)threads * CHUNKS_PER_THREAD;
+  lmo->p2 = calloc(chunks, sizeof(*lmo->p2));
+  if (!lmo->p2) {
+    return -1;
+  }
+
+  if (run_chunks(lmo, 0, lmo->z + 1, P2_SEGMENT, p2_worker, threads) < 0) {
+    return -1;
+  }
+
+  // pi(p_i) - 1 = i - 1, summed over a < i <= b.
+  int64_t sum = -((b - 1) * b / 2 - (a - 1) * a / 2);
+  int64_t before = 0;
+  for (int64_t i = 0; i < lmo->chunk_count; i++) {
+    sum += lmo->p2[i].sum + before * lmo->p2[i].hits;
+    before += lmo->p2[i].primes;
+  }
+
+  *result = sum;
+  return 0;
+}
+
+static void
+free_lmo(struct lmo *lmo)
+{
+  for (int64_t i = 0; i < lmo->s2_count; i++) {
+    free(lmo->s2[i].phi);
+    free(lmo->s2[i].leaves);
+  }
+  free(lmo->s2);
+  free(lmo->p2);
+  free(lmo->primes);
+  free(lmo->pi);
+  free(lmo->mu);
+  free(lmo->lpf);
+  pthread_mutex_destroy(&lmo->lock);
+}
+
+int64_t
+lmo_pi(int64_t x, int threads)
+{
+  // Small x by trial division; the method wants y < sqrt(x).
+  if (x < 100) {
+    int64_t count = 0;
+    for (int64_t n = 2; n <= x; n++) {
+      int64_t d = 2;
+      while (d * d <= n && n % d != 0) {
+        d++;
+      }
+      count += d * d > n;
+    }
+    return count;
+  }
+
+  struct lmo lmo = {0};
+  pthread_mutex_init(&lmo.lock, NULL);
+
+  // A larger y shortens the sieving up to x / y at the cost of
+  // more ordinary leaves.
+  double logx = log((double)x);
+  double alpha = logx * logx / 200;
+  lmo.x = x;
+  lmo.sqrtx = isqrt64(x);
+  lmo.y = icbrt64(x) * (alpha > 1 ? alpha : 1);
+  lmo.y = min64(max64(lmo.y, icbrt64(x)), lmo.sqrtx);
+  lmo.z = x / lmo.y;
+
+  int64_t segment = 1;
+  while (segment < isqrt64(lmo.z)) {
+    segment *= 2;
+  }
+  lmo.segment_size = max64(segment, 1024);
+
+  int64_t phi_s2, p2_sum;
+  int64_t result = -1;
+  if (init_tables(&lmo) == 0 &&
+      s2(&lmo, threads, &phi_s2) == 0 &&
+      p2(&lmo, threads, &p2_sum) == 0) {
+    result = s1(&lmo) + phi_s2 + lmo.pi_y - 1 - p2_sum;
+  }
+
+  free_lmo(&lmo);
+  return result;
+}
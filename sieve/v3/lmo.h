@@ -0,0 +1,7 @@
+#include <stdint.h>
+
+// Counts the primes up to and including x, which must be below
+// 2^63, with the Lagarias-Miller-Odlyzko method on the given
+// number of threads. Memory grows as the primes up to sqrt(x),
+// some 600 MB near 2^63. Returns -1 if memory runs out.
+int64_t lmo_pi(int64_t x, int threads);
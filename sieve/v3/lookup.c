@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "table.h"
+
+// gcc lookup.c table.c -O2 -g -o lookup
+
+// Answers queries from a table that sieve --table wrote:
+//
+// $ ./sieve --table primes.tab 1000000000
+// $ ./lookup primes.tab nth 1000000
+// 15485863
+//
+// Each query prints one line per number: 1 or 0 for is-prime, the
+// count of primes up to n for pi, and the n-th prime for nth.
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 4 || (strcmp(argv[2], "is-prime") != 0 &&
+                   strcmp(argv[2], "pi") != 0 && strcmp(argv[2], "nth") != 0)) {
+    fprintf(stderr, "Usage: %s table {is-prime | pi | nth} n...\n", argv[0]);
+    return 1;
+  }
+
+  struct prime_table *table = prime_table_open(argv[1]);
+  if (!table) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  int result = 0;
+  for (int i = 3; i < argc; i++) {
+    errno = 0;
+
+    char *end;
+    uint64_t n = strtoull(argv[i], &end, 10);
+    if (argv[i][0] < '0' || argv[i][0] > '9' || errno != 0 || *end != '\0') {
+      fprintf(stderr, "Invalid integer: %s\n", argv[i]);
+      result = 1;
+      break;
+    }
+
+    if (strcmp(argv[2], "nth") == 0) {
+      uint64_t prime = prime_table_nth(table, n);
+      if (prime == 0) {
+        fprintf(stderr, "No prime number %s in the table\n", argv[i]);
+        result = 1;
+        break;
+      }
+      printf("%llu\n", (unsigned long long)prime);
+      continue;
+    }
+
+    if (n > prime_table_hi(table)) {
+      fprintf(stderr, "%s is beyond the table, which ends at %llu\n",
+              argv[i], (unsigned long long)prime_table_hi(table));
+      result = 1;
+      break;
+    }
+    if (strcmp(argv[2], "pi") == 0) {
+      printf("%lld\n", (long long)prime_table_pi(table, n));
+    } else {
+      printf("%d\n", prime_table_is_prime(table, n));
+    }
+  }
+
+  prime_table_close(table);
+  return result;
+}
@@ -1,64 +1,700 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
 
-#define PRIME 1
-#define NOT_PRIME 0
+#include "lmo.h"
+#include "table.h"
+#include "wheel.h"
 
-// gcc sieve.c -g -o sieve
+// gcc sieve.c libsieve.c lmo.c -O2 -g -pthread -lm -o sieve
 
+// The wheel and the segments it is sieved in are libsieve's, and
+// declared in wheel.h.
+
+// Workers take the range a task of several segments at a time,
+// and each task's primes are printed to a buffer of its own.
+#define TASK_SEGMENTS 8
+#define TASK_BYTES ((uint64_t)SEGMENT_BYTES * TASK_SEGMENTS)
+
+// Each worker sieves a span of consecutive tasks, carrying every
+// base prime's next multiple from one segment to the next, so that
+// only the start of a span costs a division per base prime. With
+// --count and --sum each worker gets one span. Printing and --table
+// write the tasks out in order, and a worker runs at most its span
+// and TASKS_AHEAD more ahead of the output, so there spans are kept
+// to ORDERED_SPAN_TASKS.
+#define ORDERED_SPAN_TASKS 4
+#define TASKS_AHEAD 2
+
+// Two decimal digits at a time, for formatting without printf.
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+enum mode {
+  MODE_PRINT,
+  MODE_COUNT,
+  MODE_SUM,
+  MODE_LMO,
+  MODE_TABLE,
+};
+
+struct options {
+  uint64_t lo;
+  uint64_t hi;
+  int threads;
+  enum mode mode;
+  const char *table;  // the file --table writes
+};
+
+struct output {
+  char *data;
+  size_t length;
+  size_t capacity;
+  uint64_t count;
+  unsigned __int128 sum;
+  int ready;
+};
+
+struct sieve {
+  enum mode mode;
+  uint64_t lo;        // the range to sieve, hi included
+  uint64_t hi;
+  struct base base;
+  uint64_t tasks;
+
+  // The work queue: spans of span_tasks tasks are handed out in
+  // order. When the output must be in order, a worker may not run
+  // more than slot_count tasks ahead of it.
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint64_t span_tasks;
+  uint64_t spans;
+  uint64_t next_span;
+  uint64_t emitted;
+  struct output *slots;
+  size_t slot_count;
+  int failed;
+
+  uint64_t found;
+  unsigned __int128 sum;
+
+  // --table writes the wheel to fd, and each block's rank here.
+  int fd;
+  uint64_t blocks;
+  uint64_t *ranks;
+};
+
+// Parses a decimal unsigned 64-bit integer; strtoull alone would
+// take signs, leading spaces and trailing junk.
 static int
-parse_max(int argc, char **argv)
+parse_u64(const char *text, uint64_t *value)
 {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s max_prime\n", argv[0]);
+  if (*text < '0' || *text > '9') {
     return -1;
   }
 
   errno = 0;
 
-  int max = atoi(argv[1]);
-  if (errno != 0 || max == 0) {
-    fprintf(stderr, "Invalid integer for max_prime: %s\n", argv[1]);
+  char *end;
+  *value = strtoull(text, &end, 10);
+  return errno != 0 || *end != '\0' ? -1 : 0;
+}
+
+static int
+parse_args(int argc, char **argv, struct options *options)
+{
+  static const struct option long_options[] = {
+    {"count", no_argument, NULL, 'c'},
+    {"sum", no_argument, NULL, 's'},
+    {"lmo", no_argument, NULL, 'l'},
+    {"table", required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0},
+  };
+
+  options->threads = 1;
+  options->mode = MODE_PRINT;
+  options->table = NULL;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'c':
+      options->mode = MODE_COUNT;
+      break;
+    case 's':
+      options->mode = MODE_SUM;
+      break;
+    case 'l':
+      options->mode = MODE_LMO;
+      break;
+    case 't':
+      options->mode = MODE_TABLE;
+      options->table = optarg;
+      break;
+    case 'j':
+      options->threads = atoi(optarg);
+      if (options->threads < 1) {
+        fprintf(stderr, "Invalid thread count: %s\n", optarg);
+        return -1;
+      }
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-j threads] [--count | --sum | --lmo | --table file] "
+              "{max_prime | lo hi}\n", argv[0]);
+      return -1;
+    }
+  }
+
+  // One bound is the primes below max_prime; two are lo to hi,
+  // both included.
+  if (argc - optind == 1) {
+    uint64_t max;
+    if (parse_u64(argv[optind], &max) < 0 || max == 0) {
+      fprintf(stderr, "Invalid integer for max_prime: %s\n", argv[optind]);
+      return -1;
+    }
+    options->lo = 0;
+    options->hi = max - 1;
+  } else if (argc - optind == 2) {
+    if (parse_u64(argv[optind], &options->lo) < 0) {
+      fprintf(stderr, "Invalid integer for lo: %s\n", argv[optind]);
+      return -1;
+    }
+    if (parse_u64(argv[optind + 1], &options->hi) < 0) {
+      fprintf(stderr, "Invalid integer for hi: %s\n", argv[optind + 1]);
+      return -1;
+    }
+    if (options->lo > options->hi) {
+      fprintf(stderr, "Empty range: lo is above hi\n");
+      return -1;
+    }
+  } else {
+    fprintf(stderr, "Usage: %s [-j threads] [--count | --sum | --lmo | --table file] "
+            "{max_prime | lo hi}\n", argv[0]);
     return -1;
   }
 
-  return max;
+  if (options->mode == MODE_LMO && options->hi > INT64_MAX) {
+    fprintf(stderr, "--lmo counts only below 2^63\n");
+    return -1;
+  }
+  if (options->mode == MODE_TABLE && options->lo != 0) {
+    fprintf(stderr, "--table starts from 0\n");
+    return -1;
+  }
+
+  return 0;
 }
 
-static void
-run_sieve(int max, char *prime_map)
+// The sum of the primes left in the segment that starts at byte
+// low: each byte k contributes 30k for every bit set in it, plus
+// its residues.
+static unsigned __int128
+sum_segment(const uint64_t *segment, uint64_t low, uint64_t length)
+{
+  const uint8_t *bytes = (const uint8_t *)segment;
+  uint64_t count = 0;
+  uint64_t offsets = 0;
+  uint64_t residues = 0;
+
+  for (uint64_t k = 0; k < length; k++) {
+    unsigned bits = __builtin_popcount(bytes[k]);
+    count += bits;
+    offsets += k * bits;
+    residues += wheel_sum[bytes[k]];
+  }
+
+  return (unsigned __int128)30 * low * count + 30 * offsets + residues;
+}
+
+// Writes n in decimal and a newline at p, returning the end.
+static char *
+format_number(char *p, uint64_t n)
+{
+  char digits[20];
+  char *d = digits + sizeof(digits);
+
+  while (n >= 100) {
+    d -= 2;
+    memcpy(d, &digit_pairs[n % 100 * 2], 2);
+    n /= 100;
+  }
+  if (n >= 10) {
+    d -= 2;
+    memcpy(d, &digit_pairs[n * 2], 2);
+  } else {
+    *--d = '0' + n;
+  }
+
+  size_t length = digits + sizeof(digits) - d;
+  memcpy(p, d, length);
+  p[length] = '\n';
+  return p + length + 1;
+}
+
+// Makes room for length more bytes of output.
+static int
+reserve(struct output *out, size_t length)
+{
+  if (out->capacity - out->length < length) {
+    size_t capacity = out->capacity ? out->capacity * 2 : 64 * 1024;
+    while (capacity - out->length < length) {
+      capacity *= 2;
+    }
+    char *data = realloc(out->data, capacity);
+    if (!data) {
+      return -1;
+    }
+    out->data = data;
+    out->capacity = capacity;
+  }
+  return 0;
+}
+
+static int
+append(struct output *out, uint64_t prime)
+{
+  if (reserve(out, 24) < 0) {
+    return -1;
+  }
+
+  out->length = format_number(out->data + out->length, prime) - out->data;
+  return 0;
+}
+
+// Sieves one task's segments, carrying on from the previous task
+// in the span, and prints their primes to out, or counts or sums
+// them, or copies out the wheel for --table.
+static int
+run_task(struct sieve *sieve, uint64_t task, uint64_t *segment,
+         struct span *span, struct output *out)
 {
-  memset(prime_map, PRIME, max);
+  uint64_t task_low = sieve->base.first + task * TASK_BYTES;
+  uint64_t task_high = task_low + TASK_BYTES < sieve->base.end ?
+                       task_low + TASK_BYTES : sieve->base.end;
 
-  for (int i = 2; i < max; i++) {
-    if (prime_map[i] == PRIME) {
-      printf("%d\n", i);
-      for (int j = i; j < max; j += i) {
-        prime_map[j] = NOT_PRIME;
+  // The wheel leaves out 2, 3 and 5.
+  static const uint64_t small_primes[] = {2, 3, 5};
+  out->length = 0;
+  out->count = 0;
+  out->sum = 0;
+  for (int i = 0; task == 0 && i < 3; i++) {
+    if (small_primes[i] < sieve->lo || small_primes[i] > sieve->hi) {
+      continue;
+    }
+    out->count++;
+    out->sum += small_primes[i];
+    if (sieve->mode == MODE_PRINT && append(out, small_primes[i]) < 0) {
+      return -1;
+    }
+  }
+
+  for (uint64_t low = task_low; low < task_high; low += SEGMENT_BYTES) {
+    uint64_t high = low + SEGMENT_BYTES < task_high ? low + SEGMENT_BYTES : task_high;
+    if (sieve_segment(span, segment, low, high) < 0) {
+      return -1;
+    }
+    if (low == sieve->base.first) {
+      clear_head(segment, sieve->lo);
+    }
+    if (high == sieve->base.end) {
+      clear_tail(segment, low, sieve->hi);
+    }
+
+    // Each 64-bit word holds eight bytes of the wheel.
+    uint64_t words = (high - low + 7) / 8;
+
+    if (sieve->mode == MODE_COUNT) {
+      out->count += popcount(segment, words);
+      continue;
+    }
+    if (sieve->mode == MODE_SUM) {
+      out->sum += sum_segment(segment, low, words * 8);
+      continue;
+    }
+    if (sieve->mode == MODE_TABLE) {
+      // The blocks' ranks within the task, for now; write_output
+      // adds the primes before it.
+      for (uint64_t b = low; b < high; b += TABLE_BLOCK_BYTES) {
+        uint64_t length = high - b < TABLE_BLOCK_BYTES ? high - b : TABLE_BLOCK_BYTES;
+        sieve->ranks[b / TABLE_BLOCK_BYTES] = out->count;
+        out->count += popcount(segment + (b - low) / 8, (length + 7) / 8);
+      }
+      if (reserve(out, high - low) < 0) {
+        return -1;
+      }
+      memcpy(out->data + out->length, segment, high - low);
+      out->length += high - low;
+      continue;
+    }
+
+    for (uint64_t w = 0; w < words; w++) {
+      uint64_t word = segment[w];
+      while (word) {
+        unsigned b = __builtin_ctzll(word);
+        uint64_t n = 30 * (low + w * 8 + b / 8) + wheel[b % 8];
+        if (append(out, n) < 0) {
+          return -1;
+        }
+        word &= word - 1;
       }
     }
   }
+
+  return 0;
 }
 
-int
-main(int argc, char **argv)
+// Whether the tasks' output must be written in order.
+static int
+ordered(const struct sieve *sieve)
 {
-  int max = parse_max(argc, argv);
-  if (max < 0) {
-    return 1;
+  return sieve->mode == MODE_PRINT || sieve->mode == MODE_TABLE;
+}
+
+static void *
+run_worker(void *arg)
+{
+  struct sieve *sieve = arg;
+  uint64_t *segment = malloc(SEGMENT_BYTES);
+  struct span span;
+  int started = span_init(&span, &sieve->base) == 0;
+  struct output totals = {0};
+
+  pthread_mutex_lock(&sieve->lock);
+  if (!segment || !started) {
+    sieve->failed = 1;
+    pthread_cond_broadcast(&sieve->changed);
+  }
+
+  while (!sieve->failed && sieve->next_span < sieve->spans) {
+    uint64_t task = sieve->next_span++ * sieve->span_tasks;
+    uint64_t end_task = task + sieve->span_tasks < sieve->tasks ?
+                        task + sieve->span_tasks : sieve->tasks;
+    span_start(&span, sieve->base.first + end_task * TASK_BYTES);
+
+    for (; !sieve->failed && task < end_task; task++) {
+      while (!sieve->failed && ordered(sieve) &&
+             task >= sieve->emitted + sieve->slot_count) {
+        pthread_cond_wait(&sieve->changed, &sieve->lock);
+      }
+      if (sieve->failed) {
+        break;
+      }
+      pthread_mutex_unlock(&sieve->lock);
+
+      // Counts and sums need no order, and add up as they come.
+      struct output *out = ordered(sieve) ?
+                           &sieve->slots[task % sieve->slot_count] : &totals;
+      int result = run_task(sieve, task, segment, &span, out);
+
+      pthread_mutex_lock(&sieve->lock);
+      if (result < 0) {
+        sieve->failed = 1;
+      }
+      if (ordered(sieve)) {
+        out->ready = 1;
+      } else {
+        sieve->found += out->count;
+        sieve->sum += out->sum;
+        sieve->emitted++;
+      }
+      pthread_cond_broadcast(&sieve->changed);
+    }
   }
 
-  char* prime_map = malloc(max);
-  if (!prime_map) {
+  pthread_mutex_unlock(&sieve->lock);
+
+  if (started) {
+    span_free(&span);
+  }
+  free(segment);
+  return NULL;
+}
+
+static int
+write_all(int fd, const char *data, size_t length)
+{
+  while (length > 0) {
+    ssize_t n = write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += n;
+    length -= n;
+  }
+  return 0;
+}
+
+// Writes the tasks' output in order as the workers finish them,
+// with one write(2) per task, or waits for the workers to add up
+// their counts and sums. A task's table blocks are ranked from the
+// primes before it.
+static int
+write_output(struct sieve *sieve)
+{
+  if (!ordered(sieve)) {
+    pthread_mutex_lock(&sieve->lock);
+    while (!sieve->failed && sieve->emitted < sieve->tasks) {
+      pthread_cond_wait(&sieve->changed, &sieve->lock);
+    }
+    pthread_mutex_unlock(&sieve->lock);
+    return 0;
+  }
+
+  for (uint64_t task = 0; task < sieve->tasks; task++) {
+    struct output *out = &sieve->slots[task % sieve->slot_count];
+
+    pthread_mutex_lock(&sieve->lock);
+    while (!sieve->failed && !out->ready) {
+      pthread_cond_wait(&sieve->changed, &sieve->lock);
+    }
+    int failed = sieve->failed;
+    pthread_mutex_unlock(&sieve->lock);
+
+    if (failed) {
+      return 0;
+    }
+
+    if (sieve->mode == MODE_TABLE) {
+      uint64_t blocks_per_task = TASK_BYTES / TABLE_BLOCK_BYTES;
+      for (uint64_t b = task * blocks_per_task;
+           b < (task + 1) * blocks_per_task && b < sieve->blocks; b++) {
+        sieve->ranks[b] += sieve->found;
+      }
+    }
+
+    sieve->found += out->count;
+    sieve->sum += out->sum;
+
+    if (out->length > 0 && write_all(sieve->fd, out->data, out->length) < 0) {
+      perror("write");
+      pthread_mutex_lock(&sieve->lock);
+      sieve->failed = 1;
+      pthread_cond_broadcast(&sieve->changed);
+      pthread_mutex_unlock(&sieve->lock);
+      return -1;
+    }
+
+    pthread_mutex_lock(&sieve->lock);
+    out->ready = 0;
+    sieve->emitted++;
+    pthread_cond_broadcast(&sieve->changed);
+    pthread_mutex_unlock(&sieve->lock);
+  }
+
+  return 0;
+}
+
+static void
+print_u128(unsigned __int128 n)
+{
+  char digits[40];
+  char *d = digits + sizeof(digits);
+
+  *--d = '\0';
+  do {
+    *--d = '0' + n % 10;
+    n /= 10;
+  } while (n);
+
+  printf("%s\n", d);
+}
+
+// The table's layout, with the bitmap on a page of its own.
+static struct table_header
+table_header(uint64_t hi, uint64_t blocks)
+{
+  struct table_header header = {0};
+  memcpy(header.magic, TABLE_MAGIC, sizeof(header.magic));
+  header.hi = hi;
+  header.bytes = hi / 30 + 1;
+  header.blocks = blocks;
+  header.block_bytes = TABLE_BLOCK_BYTES;
+  header.bitmap_offset = (sizeof(header) + blocks * sizeof(uint64_t) + 4095) / 4096 * 4096;
+  return header;
+}
+
+// Opens the table file at the bitmap, which the tasks write in
+// order.
+static int
+open_table(const char *path, const struct table_header *header)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || lseek(fd, header->bitmap_offset, SEEK_SET) < 0) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+// Pads the bitmap to whole words and then writes the header and the
+// ranks, last, so that a table cut short has no magic.
+static int
+finish_table(int fd, const struct table_header *header, const uint64_t *ranks)
+{
+  if (ftruncate(fd, header->bitmap_offset + (header->bytes + 7) / 8 * 8) < 0 ||
+      lseek(fd, 0, SEEK_SET) < 0 ||
+      write_all(fd, (const char *)header, sizeof(*header)) < 0 ||
+      write_all(fd, (const char *)ranks, header->blocks * sizeof(*ranks)) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int
+run_sieve(const struct options *options)
+{
+  struct sieve sieve = {0};
+  uint64_t lo = options->lo;
+  uint64_t hi = options->hi;
+  int threads = options->threads;
+  enum mode mode = options->mode;
+
+  wheel_init();
+
+  sieve.mode = mode;
+  sieve.lo = lo;
+  sieve.hi = hi;
+  int based = base_init(&sieve.base, lo, hi) == 0;
+  sieve.tasks = (sieve.base.end - sieve.base.first + TASK_BYTES - 1) / TASK_BYTES;
+  sieve.span_tasks = (sieve.tasks + threads - 1) / threads;
+  if (ordered(&sieve) && sieve.span_tasks > ORDERED_SPAN_TASKS) {
+    sieve.span_tasks = ORDERED_SPAN_TASKS;
+  }
+  sieve.spans = (sieve.tasks + sieve.span_tasks - 1) / sieve.span_tasks;
+  sieve.slot_count = ordered(&sieve) ? (size_t)threads * (sieve.span_tasks + TASKS_AHEAD) : 1;
+  sieve.slots = calloc(sieve.slot_count, sizeof(*sieve.slots));
+  sieve.fd = STDOUT_FILENO;
+  pthread_t *workers = malloc(sizeof(*workers) * threads);
+
+  struct table_header header;
+  if (mode == MODE_TABLE) {
+    sieve.blocks = (sieve.base.end + TABLE_BLOCK_BYTES - 1) / TABLE_BLOCK_BYTES;
+    sieve.ranks = malloc(sizeof(*sieve.ranks) * sieve.blocks);
+    header = table_header(hi, sieve.blocks);
+  }
+
+  if (!based || !sieve.slots || !workers ||
+      (mode == MODE_TABLE && !sieve.ranks)) {
+    fprintf(stderr, "Memory allocation failed!\n");
+    sieve.fd = -1;
+  } else if (mode == MODE_TABLE) {
+    sieve.fd = open_table(options->table, &header);
+  }
+
+  if (sieve.fd < 0) {
+    free(sieve.ranks);
+    free(workers);
+    free(sieve.slots);
+    if (based) {
+      base_free(&sieve.base);
+    }
+    return -1;
+  }
+
+  pthread_mutex_init(&sieve.lock, NULL);
+  pthread_cond_init(&sieve.changed, NULL);
+
+  int started = 0;
+  for (; started < threads; started++) {
+    if (pthread_create(&workers[started], NULL, run_worker, &sieve) != 0) {
+      break;
+    }
+  }
+
+  int result = -1;
+  if (started > 0) {
+    result = write_output(&sieve);
+  } else {
+    fprintf(stderr, "Thread creation failed!\n");
+  }
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  for (size_t i = 0; i < sieve.slot_count; i++) {
+    free(sieve.slots[i].data);
+  }
+
+  if (result == 0 && sieve.failed) {
     fprintf(stderr, "Memory allocation failed!\n");
+    result = -1;
+  }
+
+  if (result == 0 && mode == MODE_COUNT) {
+    printf("%llu\n", (unsigned long long)sieve.found);
+  } else if (result == 0 && mode == MODE_SUM) {
+    print_u128(sieve.sum);
+  } else if (result == 0 && mode == MODE_TABLE) {
+    header.count = sieve.found;
+    if (finish_table(sieve.fd, &header, sieve.ranks) < 0) {
+      perror(options->table);
+      result = -1;
+    }
+  }
+
+  if (mode == MODE_TABLE && close(sieve.fd) < 0 && result == 0) {
+    perror(options->table);
+    result = -1;
+  }
+
+  pthread_cond_destroy(&sieve.changed);
+  pthread_mutex_destroy(&sieve.lock);
+  free(sieve.ranks);
+  free(workers);
+  free(sieve.slots);
+  base_free(&sieve.base);
+  return result;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+  if (parse_args(argc, argv, &options) < 0) {
     return 1;
   }
 
-  run_sieve(max, prime_map);
+  // --lmo counts the same primes as --count.
+  if (options.mode == MODE_LMO) {
+    int64_t count = lmo_pi(options.hi, options.threads);
+    if (count >= 0 && options.lo > 0) {
+      int64_t below = lmo_pi(options.lo - 1, options.threads);
+      count = below < 0 ? -1 : count - below;
+    }
+    if (count < 0) {
+      fprintf(stderr, "Memory allocation failed!\n");
+      return 1;
+    }
+    printf("%lld\n", (long long)count);
+    return 0;
+  }
 
-  free(prime_map);
+  if (run_sieve(&options) < 0) {
+    return 1;
+  }
 
   return 0;
 }
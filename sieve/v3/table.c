@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "table.h"
+
+// Lookups in a prime table mapped read-only, so that processes
+// using the same file share its pages. is_prime tests one bit, pi
+// adds a block's rank to the bits set before n within the block,
+// and nth searches the ranks and then counts through one block.
+
+struct prime_table {
+  const struct table_header *header;
+  const uint64_t *ranks;
+  const uint8_t *bitmap;
+  size_t length;
+};
+
+static const uint8_t wheel[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+// The bit of each residue mod 30 in a byte, or 0xff for those
+// that share a factor with 30.
+static const uint8_t wheel_bit[30] = {
+  0xff, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 1, 0xff, 0xff,
+  0xff, 2, 0xff, 3, 0xff, 0xff, 0xff, 4, 0xff, 5,
+  0xff, 0xff, 0xff, 6, 0xff, 0xff, 0xff, 0xff, 0xff, 7,
+};
+
+static const uint64_t small_primes[] = {2, 3, 5};
+
+struct prime_table *
+prime_table_open(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  if ((uint64_t)st.st_size < sizeof(struct table_header)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  // The bitmap is padded to whole words, which the lookups read.
+  const struct table_header *header = map;
+  uint64_t size = st.st_size;
+  uint64_t block = header->block_bytes;
+  if (memcmp(header->magic, TABLE_MAGIC, sizeof(header->magic)) != 0 ||
+      block == 0 || block % 8 != 0 ||
+      header->bytes != header->hi / 30 + 1 ||
+      header->blocks != (header->bytes + block - 1) / block ||
+      header->blocks > (size - sizeof(*header)) / sizeof(uint64_t) ||
+      header->bitmap_offset < sizeof(*header) + header->blocks * sizeof(uint64_t) ||
+      header->bitmap_offset % 8 != 0 || header->bitmap_offset > size ||
+      (header->bytes + 7) / 8 * 8 > size - header->bitmap_offset) {
+    munmap(map, st.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  struct prime_table *table = malloc(sizeof(*table));
+  if (!table) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  table->header = header;
+  table->ranks = (const uint64_t *)(header + 1);
+  table->bitmap = (const uint8_t *)map + header->bitmap_offset;
+  table->length = st.st_size;
+  return table;
+}
+
+void
+prime_table_close(struct prime_table *table)
+{
+  if (table) {
+    munmap((void *)table->header, table->length);
+    free(table);
+  }
+}
+
+uint64_t
+prime_table_hi(const struct prime_table *table)
+{
+  return table->header->hi;
+}
+
+int
+prime_table_is_prime(const struct prime_table *table, uint64_t n)
+{
+  if (n > table->header->hi) {
+    return -1;
+  }
+  if (n < 7) {
+    return n == 2 || n == 3 || n == 5;
+  }
+
+  unsigned bit = wheel_bit[n % 30];
+  return bit != 0xff && (table->bitmap[n / 30] >> bit & 1);
+}
+
+int64_t
+prime_table_pi(const struct prime_table *table, uint64_t n)
+{
+  if (n > table->header->hi) {
+    return -1;
+  }
+  if (n < 7) {
+    return (n >= 2) + (n >= 3) + (n >= 5);
+  }
+
+  // The bits of byte k up to n, and of the bytes before it in the
+  // same word; both words and blocks start at multiples of 8.
+  uint64_t k = n / 30;
+  uint64_t block = k / table->header->block_bytes;
+  const uint64_t *words = (const uint64_t *)table->bitmap;
+  unsigned shift = k % 8 * 8;
+  unsigned below = 0;
+  for (int i = 0; i < 8 && wheel[i] <= n % 30; i++) {
+    below |= 1 << i;
+  }
+
+  int64_t count = table->ranks[block];
+  for (uint64_t w = block * table->header->block_bytes / 8; w < k / 8; w++) {
+    count += __builtin_popcountll(words[w]);
+  }
+  uint64_t mask = ((UINT64_C(1) << shift) - 1) | (uint64_t)below << shift;
+  return count + __builtin_popcountll(words[k / 8] & mask);
+}
+
+uint64_t
+prime_table_nth(const struct prime_table *table, uint64_t k)
+{
+  const struct table_header *header = table->header;
+  if (k == 0 || k > header->count) {
+    return 0;
+  }
+  if (k <= table->ranks[0]) {
+    return small_primes[k - 1];
+  }
+
+  // The last block whose rank is below k holds the k-th prime.
+  uint64_t lo = 0;
+  uint64_t hi = header->blocks;
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (table->ranks[mid] < k) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  const uint64_t *words = (const uint64_t *)table->bitmap;
+  uint64_t left = k - table->ranks[lo];
+  for (uint64_t w = lo * header->block_bytes / 8; ; w++) {
+    uint64_t word = words[w];
+    unsigned bits = __builtin_popcountll(word);
+    if (bits < left) {
+      left -= bits;
+      continue;
+    }
+
+    while (--left > 0) {
+      word &= word - 1;
+    }
+    unsigned b = __builtin_ctzll(word);
+    return 30 * (w * 8 + b / 8) + wheel[b % 8];
+  }
+}
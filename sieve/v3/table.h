@@ -0,0 +1,41 @@
+#include <stdint.h>
+
+// A prime table file, as written by sieve --table: this header,
+// then blocks ranks, then from bitmap_offset on the mod 30 wheel
+// itself, byte k holding one bit for each of 30k + 1, 7, 11, 13,
+// 17, 19, 23 and 29. Rank b counts the primes below byte
+// b * block_bytes, with 2, 3 and 5 among them. The file is in the
+// byte order of the machine that wrote it.
+#define TABLE_MAGIC "PRIMETB1"
+#define TABLE_BLOCK_BYTES 4096
+
+struct table_header {
+  char magic[8];
+  uint64_t hi;             // the table covers 0 to hi
+  uint64_t count;          // primes up to hi
+  uint64_t bytes;          // of the bitmap
+  uint64_t blocks;
+  uint64_t block_bytes;
+  uint64_t bitmap_offset;  // page aligned
+};
+
+struct prime_table;
+
+// Maps a table file read-only. Returns NULL with errno set if it
+// cannot, or EINVAL if the file is not a prime table.
+struct prime_table *prime_table_open(const char *path);
+void prime_table_close(struct prime_table *table);
+
+// The largest number the table covers.
+uint64_t prime_table_hi(const struct prime_table *table);
+
+// Whether n is prime, or -1 if n is above the table's hi.
+int prime_table_is_prime(const struct prime_table *table, uint64_t n);
+
+// The number of primes up to and including n, or -1 if n is above
+// the table's hi.
+int64_t prime_table_pi(const struct prime_table *table, uint64_t n);
+
+// The k-th prime, counting 2 as the first, or 0 if the table holds
+// fewer than k primes.
+uint64_t prime_table_nth(const struct prime_table *table, uint64_t k);
@@ -0,0 +1,99 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// The segmented mod 30 wheel that sieve.c and the library's
+// iterator both run on, implemented in libsieve.c. Not part of the
+// library's interface.
+
+// Byte k of the map covers 30k to 30k + 29, one bit for each of
+// the eight numbers there that are prime to 2, 3 and 5. A segment
+// is sized to stay in L1.
+#define SEGMENT_BYTES (32 * 1024)
+
+// Segments start as a copy of a tile with the multiples of 7, 11
+// and 13 already struck, which repeats every 7 * 11 * 13 bytes.
+#define TILE_BYTES (7 * 11 * 13)
+
+// Primes of at least this many bytes, p / 30, strike a segment no
+// more than a few times, so rather than visit each of them in every
+// segment a span files them in buckets by the segment of their next
+// multiple, after Oliveira e Silva.
+#define BUCKET_BYTES (SEGMENT_BYTES / 4)
+
+extern const uint8_t wheel[8];
+
+// The sum of the residues whose bits are set in a byte.
+extern uint16_t wheel_sum[256];
+
+// Counts the bits set in a run of words, with AVX2 or POPCNT when
+// the processor has them.
+extern uint64_t (*popcount)(const uint64_t *words, size_t count);
+
+// The base primes for sieving lo to hi, shared by every span of it.
+// Segments are counted from first, the byte that holds lo.
+struct base {
+  uint64_t first;     // the bytes that hold the range, end excluded
+  uint64_t end;
+  uint32_t *primes;   // p > 13 with p * p <= hi
+  size_t count;
+  size_t large;       // the first to go in buckets
+  size_t bucket_count;
+};
+
+// The large primes due in one segment, each as its index in the
+// base primes above its next multiple, given as the byte from the
+// segment's start shifted left by 3 above the wheel position.
+struct bucket {
+  uint64_t *entries;
+  size_t length;
+  size_t capacity;
+};
+
+// A run of consecutive segments, sieved in order by one thread.
+// The small primes' next multiples are in next, and the large
+// primes' are in a ring of buckets, one per segment, with enough of
+// them to reach the furthest a large prime can step ahead. Primes
+// start once the sieve reaches their square, and those whose next
+// multiple is past the span drop out.
+struct span {
+  const struct base *base;
+  uint64_t end;            // the byte after the span
+  size_t small_started;    // of the primes below large
+  size_t large_started;    // of the primes from large on
+  uint64_t *next;
+  struct bucket *buckets;
+};
+
+// Sets up the tables above, once. Every other call needs it done.
+void wheel_init(void);
+
+// Finds the base primes for lo to hi, both included. Returns -1 if
+// memory runs out.
+int base_init(struct base *base, uint64_t lo, uint64_t hi);
+
+void base_free(struct base *base);
+
+// Collects the primes 13 < p with p * p <= hi into a new array.
+// Returns NULL if memory runs out.
+uint32_t *find_base_primes(uint64_t hi, size_t *count);
+
+int span_init(struct span *span, const struct base *base);
+
+// Starts the span over on the segments up to the byte end, which
+// the next sieve_segment must be the first of.
+void span_start(struct span *span, uint64_t end);
+
+void span_free(struct span *span);
+
+// Fills the segment holding bytes [low, high) of the span and
+// strikes the multiples of the base primes from it. Segments must
+// come in order. Returns -1 if memory runs out.
+int sieve_segment(struct span *span, uint64_t *segment, uint64_t low, uint64_t high);
+
+// Clears the bits of the numbers below lo, in the segment that
+// starts with the byte holding lo.
+void clear_head(uint64_t *segment, uint64_t lo);
+
+// Clears the bits of the numbers above hi, in the segment that
+// starts at byte low and holds hi, and everything after them.
+void clear_tail(uint64_t *segment, uint64_t low, uint64_t hi);